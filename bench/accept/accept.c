@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <inginx.h>
+
+#define PORT 18284
+
+typedef struct connector {
+  pthread_t thread;
+  int32_t port;
+  int32_t connections;
+} connector;
+
+static int32_t connected;
+static int32_t disconnected;
+
+static void listener(inginxServer *s, inginxClient *c, inginxEventType type, void *data, void *opaque)
+{
+  if (type == INGINX_EVENT_TYPE_CONNECTED) {
+    __atomic_add_fetch(&connected, 1, __ATOMIC_RELEASE);
+  } else if (type == INGINX_EVENT_TYPE_DISCONNECTED) {
+    __atomic_add_fetch(&disconnected, 1, __ATOMIC_RELEASE);
+  }
+}
+
+static void *serve(void *server)
+{
+  inginxServerMain(server);
+  return NULL;
+}
+
+/* Connect and close right away, the worker accepts and frees a client for
+ * each connection. Closing with a reset leaves no TIME_WAIT behind, which
+ * would otherwise exhaust the local ports and slow down connect(). */
+static void *run(void *arg)
+{
+  connector *conn = arg;
+  struct linger reset = {1, 0};
+  struct sockaddr_in address;
+  int32_t idx;
+  int fd;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(conn->port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  for (idx = 0; idx < conn->connections; ++idx) {
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr *) &address, sizeof(address)) != 0) {
+      perror("connect");
+      exit(1);
+    }
+    setsockopt(fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+    close(fd);
+  }
+  return NULL;
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench(const char *label, int32_t completion, int32_t port, int32_t threads, int32_t connections)
+{
+  connector *conns = calloc(threads, sizeof(connector));
+  inginxServer *server = inginxServerCreate();
+  inginxPoolStats stats;
+  char address[32];
+  pthread_t thread;
+  double start, elapsed;
+  int32_t idx;
+
+  /* A multishot accept drains the backlog ahead of the worker, so with
+   * completion based I/O accepted sockets queue up beyond the limit: keep
+   * it well under the open file limit. */
+  inginxServerConnectionLimit(server, 8192);
+  if (completion) {
+    inginxServerCompletion(server);
+  }
+  snprintf(address, sizeof(address), "127.0.0.1:%d", port);
+  if (inginxServerBind(server, address, 4096) == NULL) {
+    fprintf(stderr, "Could not bind %s\n", address);
+    exit(1);
+  }
+  inginxServerListener(server, listener, INGINX_EVENT_TYPE_ALL, NULL);
+  pthread_create(&thread, NULL, serve, server);
+  usleep(100000);
+
+  connected = disconnected = 0;
+  start = now();
+  for (idx = 0; idx < threads; ++idx) {
+    conns[idx].port = port;
+    conns[idx].connections = connections;
+    pthread_create(&conns[idx].thread, NULL, run, conns + idx);
+  }
+  for (idx = 0; idx < threads; ++idx) {
+    pthread_join(conns[idx].thread, NULL);
+  }
+  /* Every connection got a client, even those closed over the limit, and
+   * every client that connected is gone. */
+  do {
+    sched_yield();
+    inginxServerClientPoolStats(server, &stats);
+  } while (stats.allocated + stats.reused < threads * connections ||
+      __atomic_load_n(&disconnected, __ATOMIC_ACQUIRE) < __atomic_load_n(&connected, __ATOMIC_ACQUIRE));
+  elapsed = now() - start;
+
+  printf("%-12s %9.0f accept+close/s  clients allocated %lld reused %lld idle %lld", label,
+      threads * connections / elapsed, (long long) stats.allocated, (long long) stats.reused,
+      (long long) stats.idle);
+  if (connected < threads * connections) {
+    printf("  %d over the limit", threads * connections - connected);
+  }
+  printf("\n");
+
+  inginxServerShutdown(server);
+  pthread_join(thread, NULL);
+  inginxServerFree(server);
+  free(conns);
+}
+
+int main(int argc, char **argv)
+{
+  int32_t threads = argc > 1 ? atoi(argv[1]) : 4;
+  int32_t connections = argc > 2 ? atoi(argv[2]) : 20000;
+
+  printf("%d threads connecting and closing %d times each\n", threads, connections);
+  bench("readiness", 0, PORT, threads, connections);
+  bench("completion", 1, PORT + 1, threads, connections);
+  return 0;
+}
@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <inginx.h>
+
+#define PORT 18283
+
+static const char *request = "GET /ping HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+static void listener(inginxServer *s, inginxClient *c, inginxEventType type, void *data, void *opaque)
+{
+  if (type != INGINX_EVENT_TYPE_REQUEST) {
+    return;
+  }
+  inginxClientSetStatus(c, 200);
+  inginxClientAddBody(c, "ok");
+}
+
+static void *serve(void *server)
+{
+  inginxServerMain(server);
+  return NULL;
+}
+
+static int connectServer(void)
+{
+  int one = 1;
+  struct sockaddr_in address;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(PORT);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (fd == -1 || connect(fd, (struct sockaddr *) &address, sizeof(address)) != 0) {
+    perror("connect");
+    exit(1);
+  }
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+/* Send one request and wait for its response. */
+static size_t ping(int fd, size_t responseLength)
+{
+  char buffer[1024];
+  size_t length = 0;
+  ssize_t nread;
+  if (write(fd, request, strlen(request)) != (ssize_t) strlen(request)) {
+    perror("write");
+    exit(1);
+  }
+  do {
+    if ((nread = read(fd, buffer, sizeof(buffer))) <= 0) {
+      perror("read");
+      exit(1);
+    }
+    length += nread;
+  } while (length < responseLength);
+  return length;
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double cpuTime(clockid_t clock)
+{
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compareDouble(const void *a, const void *b)
+{
+  double x = *(const double *) a, y = *(const double *) b;
+  return x < y ? -1 : x > y;
+}
+
+/* Open, use and close count connections, one every 1/rate seconds. */
+static void churn(clockid_t serverClock, int32_t idle, int32_t rate, int32_t count, size_t responseLength)
+{
+  double *latencies = malloc(count * sizeof(double));
+  double start, begin, serverStart, next;
+  struct timespec ts;
+  int32_t idx;
+  int fd;
+  serverStart = cpuTime(serverClock);
+  start = now();
+  for (idx = 0; idx < count; ++idx) {
+    next = start + (double) idx / rate;
+    ts.tv_sec = (time_t) next;
+    ts.tv_nsec = (long) ((next - ts.tv_sec) * 1e9);
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    begin = now();
+    fd = connectServer();
+    ping(fd, responseLength);
+    close(fd);
+    latencies[idx] = now() - begin;
+  }
+  /* Let the worker see the last close. */
+  usleep(100000);
+  qsort(latencies, count, sizeof(double), compareDouble);
+  printf("%8d idle %8.1f us p50 %8.1f us p99 %8.1f us server cpu/connection\n", idle,
+      latencies[count / 2] * 1e6, latencies[count * 99 / 100] * 1e6,
+      (cpuTime(serverClock) - serverStart) / count * 1e6);
+  free(latencies);
+}
+
+int main(int argc, char **argv)
+{
+  int32_t idle = argc > 1 ? atoi(argv[1]) : 8000;
+  int32_t rate = argc > 2 ? atoi(argv[2]) : 2000;
+  int32_t count = argc > 3 ? atoi(argv[3]) : 4000;
+  int32_t steps[] = {0, idle / 10, idle}, step, idx, opened = 0;
+  int *idles = malloc((idle + 1) * sizeof(int));
+  inginxServer *server = inginxServerCreate();
+  clockid_t serverClock;
+  size_t responseLength;
+  pthread_t thread;
+
+  /* Both ends of every connection live in this process. */
+  inginxServerConnectionLimit(server, 2 * idle + 1024);
+  if (inginxServerBind(server, "127.0.0.1:18283", 4096) == NULL) {
+    fprintf(stderr, "Could not bind 127.0.0.1:%d\n", PORT);
+    return 1;
+  }
+  inginxServerListener(server, listener, INGINX_EVENT_TYPE_ALL, NULL);
+  pthread_create(&thread, NULL, serve, server);
+  pthread_getcpuclockid(thread, &serverClock);
+  usleep(100000);
+
+  /* Every response is the same, learn its length. */
+  idles[0] = connectServer();
+  responseLength = ping(idles[0], 1);
+  close(idles[0]);
+
+  printf("%d connections opened and closed at %d/s, each with one request\n", count, rate);
+  for (step = 0; step < 3; ++step) {
+    /* Idle keep-alive connections that already sent a request. */
+    for (; opened < steps[step]; ++opened) {
+      idles[opened] = connectServer();
+      ping(idles[opened], responseLength);
+    }
+    churn(serverClock, opened, rate, count, responseLength);
+  }
+
+  for (idx = 0; idx < opened; ++idx) {
+    close(idles[idx]);
+  }
+  inginxServerShutdown(server);
+  pthread_join(thread, NULL);
+  inginxServerFree(server);
+  free(idles);
+  return 0;
+}
@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <inginx.h>
+#include "ae.h"
+
+#define PORT 18285
+/* Local ports per source address, 127.0.0.x are all loopback. */
+#define CONNECTIONS_PER_SOURCE 20000
+
+static const char *request = "GET /plaintext HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+/* The load client, it keeps a number of requests in flight on every
+ * connection. */
+typedef struct load {
+  aeEventLoop *el;
+  size_t responseLength;
+  int64_t responses;
+} load;
+
+typedef struct connection {
+  int fd;
+  size_t partial;
+} connection;
+
+static load client;
+
+static void listener(inginxServer *s, inginxClient *c, inginxEventType type, void *data, void *opaque)
+{
+  if (type != INGINX_EVENT_TYPE_REQUEST) {
+    return;
+  }
+  inginxClientSetStatus(c, 200);
+  inginxClientAddBody(c, "ok");
+}
+
+static void *serve(void *server)
+{
+  inginxServerMain(server);
+  return NULL;
+}
+
+static int connectServer(int32_t port, int32_t idx)
+{
+  int one = 1;
+  struct sockaddr_in address;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK + 1 + idx / CONNECTIONS_PER_SOURCE);
+  /* Pick the local port at connect time, per source address. */
+  if (fd == -1 || setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one)) != 0 ||
+      bind(fd, (struct sockaddr *) &address, sizeof(address)) != 0) {
+    perror("bind");
+    exit(1);
+  }
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, (struct sockaddr *) &address, sizeof(address)) != 0) {
+    perror("connect");
+    exit(1);
+  }
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+static void sendRequests(int fd, int32_t count)
+{
+  char batch[4096];
+  size_t length = strlen(request), size = 0;
+  while (count-- > 0) {
+    memcpy(batch + size, request, length);
+    size += length;
+  }
+  if (write(fd, batch, size) != (ssize_t) size) {
+    perror("write");
+    exit(1);
+  }
+}
+
+/* Every response is the same, send a request for each one completed. */
+static void readResponses(aeEventLoop *el, int fd, void *data, int mask)
+{
+  connection *conn = data;
+  char buffer[16384];
+  ssize_t nread = read(fd, buffer, sizeof(buffer));
+  int32_t completed;
+  if (nread <= 0) {
+    if (nread < 0 && errno == EAGAIN) {
+      return;
+    }
+    fprintf(stderr, "Connection lost\n");
+    exit(1);
+  }
+  conn->partial += nread;
+  completed = conn->partial / client.responseLength;
+  conn->partial %= client.responseLength;
+  if (completed > 0) {
+    client.responses += completed;
+    sendRequests(fd, completed);
+  }
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench(const char *label, int32_t completion, int32_t port, int32_t connections, int32_t depth,
+    double duration)
+{
+  connection *conns = calloc(connections, sizeof(connection));
+  struct linger reset = {1, 0};
+  inginxServer *server = inginxServerCreate();
+  char address[32], buffer[1024];
+  pthread_t thread;
+  double start;
+  int32_t idx;
+
+  /* Both ends of every connection live in this process. */
+  inginxServerConnectionLimit(server, 2 * connections + 1024);
+  if (completion) {
+    inginxServerCompletion(server);
+  }
+  snprintf(address, sizeof(address), "127.0.0.1:%d", port);
+  if (inginxServerBind(server, address, 4096) == NULL) {
+    fprintf(stderr, "Could not bind %s\n", address);
+    exit(1);
+  }
+  inginxServerListener(server, listener, INGINX_EVENT_TYPE_ALL, NULL);
+  pthread_create(&thread, NULL, serve, server);
+  usleep(100000);
+
+  for (idx = 0; idx < connections; ++idx) {
+    conns[idx].fd = connectServer(port, idx);
+  }
+  /* Learn the length of a response. */
+  sendRequests(conns[0].fd, 1);
+  usleep(100000);
+  client.responseLength = read(conns[0].fd, buffer, sizeof(buffer));
+
+  client.el = aeCreateEventLoop(2 * connections + 1024);
+  client.responses = 0;
+  for (idx = 0; idx < connections; ++idx) {
+    fcntl(conns[idx].fd, F_SETFL, fcntl(conns[idx].fd, F_GETFL) | O_NONBLOCK);
+    if (aeCreateFileEvent(client.el, conns[idx].fd, AE_READABLE, readResponses, conns + idx) == AE_ERR) {
+      fprintf(stderr, "Could not watch connection %d\n", idx);
+      exit(1);
+    }
+    sendRequests(conns[idx].fd, depth);
+  }
+  start = now();
+  while (now() - start < duration) {
+    aeProcessEvents(client.el, AE_FILE_EVENTS);
+  }
+  printf("%-11s %7d connections %3d in flight %10.0f requests/s\n", label, connections, depth,
+      client.responses / (now() - start));
+
+  for (idx = 0; idx < connections; ++idx) {
+    aeDeleteFileEvent(client.el, conns[idx].fd, AE_READABLE);
+    setsockopt(conns[idx].fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+    close(conns[idx].fd);
+  }
+  aeDeleteEventLoop(client.el);
+  inginxServerShutdown(server);
+  pthread_join(thread, NULL);
+  inginxServerFree(server);
+  free(conns);
+}
+
+int main(int argc, char **argv)
+{
+  static const int32_t depths[] = {1, 16};
+  int32_t connections = argc > 1 ? atoi(argv[1]) : 50000;
+  double duration = argc > 2 ? atof(argv[2]) : 5;
+  rlim_t needed = 2 * (rlim_t) connections + 1024;
+  struct rlimit limit;
+  int32_t idx, port = PORT;
+
+  /* The server and the load client share the open file limit. */
+  getrlimit(RLIMIT_NOFILE, &limit);
+  if (limit.rlim_cur < needed) {
+    limit.rlim_cur = needed;
+    if (limit.rlim_max < needed) {
+      limit.rlim_max = needed;
+    }
+    if (setrlimit(RLIMIT_NOFILE, &limit) != 0) {
+      getrlimit(RLIMIT_NOFILE, &limit);
+      fprintf(stderr, "%d connections need %llu open files, the limit is %llu: %s\n", connections,
+          (unsigned long long) needed, (unsigned long long) limit.rlim_max, strerror(errno));
+      return 1;
+    }
+  }
+
+  printf("one worker, one load client thread, %.0fs per run\n", duration);
+  for (idx = 0; idx < (int32_t) (sizeof(depths) / sizeof(depths[0])); ++idx) {
+    bench("readiness", 0, port++, connections, depths[idx], duration);
+    bench("completion", 1, port++, connections, depths[idx], duration);
+  }
+  return 0;
+}
@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <inginx.h>
+
+#define PORT 18280
+
+static const char *request = "GET /plaintext HTTP/1.1\r\n"
+  "Host: localhost\r\n"
+  "User-Agent: pipeline\r\n"
+  "Accept: application/json\r\n"
+  "\r\n";
+
+typedef struct connection {
+  pthread_t thread;
+  int fd;
+  int32_t depth;
+  int64_t batches;
+  size_t responseLength;
+  int64_t writes;
+} connection;
+
+static void listener(inginxServer *s, inginxClient *c, inginxEventType type, void *data, void *opaque)
+{
+  if (type != INGINX_EVENT_TYPE_REQUEST) {
+    return;
+  }
+  inginxClientSetStatus(c, 200);
+  inginxClientAddHeader(c, "Content-Type", "application/json");
+  inginxClientAddHeader(c, "Cache-Control", "no-store");
+  inginxClientAddBody(c, "{\"id\":42,\"name\":\"pipeline\",\"tags\":[\"a\",\"b\",\"c\"],\"ok\":true}");
+}
+
+static void *serve(void *server)
+{
+  inginxServerMain(server);
+  return NULL;
+}
+
+static int connectServer(int receiveBuffer)
+{
+  int one = 1;
+  struct sockaddr_in address;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (receiveBuffer > 0) {
+    /* A small window fills up and leaves the rest to the write handler. */
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &receiveBuffer, sizeof(receiveBuffer));
+  }
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(PORT);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, (struct sockaddr *) &address, sizeof(address)) != 0) {
+    perror("connect");
+    exit(1);
+  }
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+static void writeAll(int fd, const char *data, size_t length)
+{
+  ssize_t nwritten;
+  while (length > 0) {
+    if ((nwritten = write(fd, data, length)) <= 0) {
+      perror("write");
+      exit(1);
+    }
+    data += nwritten;
+    length -= nwritten;
+  }
+}
+
+static void readAll(int fd, char *buffer, size_t size, size_t length)
+{
+  ssize_t nread;
+  while (length > 0) {
+    if ((nread = read(fd, buffer, length < size ? length : size)) <= 0) {
+      perror("read");
+      exit(1);
+    }
+    length -= nread;
+  }
+}
+
+/* Send depth requests at once, wait for all of their responses, repeat. */
+static void *run(void *arg)
+{
+  connection *conn = arg;
+  size_t length = strlen(request);
+  char *batch = malloc(length * conn->depth), buffer[64 * 1024];
+  int32_t idx;
+  int64_t round;
+  for (idx = 0; idx < conn->depth; ++idx) {
+    memcpy(batch + idx * length, request, length);
+  }
+  for (round = 0; round < conn->batches; ++round) {
+    writeAll(conn->fd, batch, length * conn->depth);
+    conn->writes++;
+    readAll(conn->fd, buffer, sizeof(buffer), conn->responseLength * conn->depth);
+  }
+  free(batch);
+  return NULL;
+}
+
+/* Write syscalls of the whole process, -1 if unknown. */
+static int64_t processWrites(void)
+{
+  char line[128];
+  long long value = -1;
+  FILE *file = fopen("/proc/self/io", "r");
+  if (file == NULL) {
+    return -1;
+  }
+  while (fgets(line, sizeof(line), file) != NULL) {
+    if (sscanf(line, "syscw: %lld", &value) == 1) {
+      break;
+    }
+  }
+  fclose(file);
+  return value;
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+  static const int32_t depths[] = {1, 8, 32, 128};
+  int32_t connections = argc > 1 ? atoi(argv[1]) : 4;
+  int64_t requests = argc > 2 ? atoll(argv[2]) : 400000;
+  int32_t receiveBuffer = argc > 3 ? atoi(argv[3]) : 0;
+  int32_t idx, conn, depth;
+  int64_t writes, clientWrites;
+  char buffer[4096];
+  size_t responseLength;
+  double start, elapsed;
+  connection *conns = calloc(connections, sizeof(connection));
+  pthread_t thread;
+  inginxServer *server = inginxServerCreate();
+  inginxServerConnectionLimit(server, 1024);
+  if (inginxServerBind(server, "127.0.0.1:18280", 128) == NULL) {
+    fprintf(stderr, "Could not bind 127.0.0.1:%d\n", PORT);
+    return 1;
+  }
+  inginxServerListener(server, listener, INGINX_EVENT_TYPE_ALL, NULL);
+  pthread_create(&thread, NULL, serve, server);
+  usleep(100000);
+
+  /* Every response is the same, learn its length. */
+  conns[0].fd = connectServer(receiveBuffer);
+  writeAll(conns[0].fd, request, strlen(request));
+  usleep(100000);
+  responseLength = read(conns[0].fd, buffer, sizeof(buffer));
+  for (idx = 1; idx < connections; ++idx) {
+    conns[idx].fd = connectServer(receiveBuffer);
+  }
+
+  printf("%d connections, %zu bytes per response\n", connections, responseLength);
+  for (idx = 0; idx < (int32_t) (sizeof(depths) / sizeof(depths[0])); ++idx) {
+    depth = depths[idx];
+    writes = processWrites();
+    clientWrites = 0;
+    start = now();
+    for (conn = 0; conn < connections; ++conn) {
+      conns[conn].depth = depth;
+      conns[conn].batches = requests / connections / depth;
+      conns[conn].responseLength = responseLength;
+      conns[conn].writes = 0;
+      pthread_create(&conns[conn].thread, NULL, run, conns + conn);
+    }
+    for (conn = 0; conn < connections; ++conn) {
+      pthread_join(conns[conn].thread, NULL);
+      clientWrites += conns[conn].writes;
+    }
+    elapsed = now() - start;
+    printf("depth %4d %10.0f requests/s", depth,
+        (double) conns[0].batches * depth * connections / elapsed);
+    if (writes >= 0) {
+      printf(" %8.3f server writes/request",
+          (double) (processWrites() - writes - clientWrites) / (conns[0].batches * depth * connections));
+    }
+    printf("\n");
+  }
+
+  for (idx = 0; idx < connections; ++idx) {
+    close(conns[idx].fd);
+  }
+  inginxServerShutdown(server);
+  pthread_join(thread, NULL);
+  inginxServerFree(server);
+  free(conns);
+  return 0;
+}
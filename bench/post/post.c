@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <inginx.h>
+
+#define PORT 18282
+
+typedef struct producer {
+  pthread_t thread;
+  inginxServer *server;
+  int64_t first;
+  int64_t count;
+} producer;
+
+/* Post time of every task, and how long it waited to run. */
+static double *posted;
+static double *waited;
+static int64_t executed;
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *serve(void *server)
+{
+  inginxServerMain(server);
+  return NULL;
+}
+
+static void execute(inginxServer *server, void *opaque)
+{
+  int64_t idx = (intptr_t) opaque;
+  waited[idx] = now() - posted[idx];
+  __atomic_store_n(&executed, executed + 1, __ATOMIC_RELEASE);
+}
+
+static void *run(void *arg)
+{
+  producer *p = arg;
+  int64_t idx;
+  for (idx = p->first; idx < p->first + p->count; ++idx) {
+    posted[idx] = now();
+    if (inginxServerPost(p->server, execute, (void *) (intptr_t) idx) != 0) {
+      fprintf(stderr, "Could not post\n");
+      exit(1);
+    }
+  }
+  return NULL;
+}
+
+/* Yield while waiting, the worker may share the CPU with this thread. */
+static void waitExecuted(int64_t count)
+{
+  while (__atomic_load_n(&executed, __ATOMIC_ACQUIRE) < count) {
+    sched_yield();
+  }
+}
+
+static int compareDouble(const void *a, const void *b)
+{
+  double x = *(const double *) a, y = *(const double *) b;
+  return x < y ? -1 : x > y;
+}
+
+static void report(const char *label, int64_t count, double elapsed)
+{
+  char throughput[32] = "";
+  qsort(waited, count, sizeof(double), compareDouble);
+  if (elapsed > 0) {
+    snprintf(throughput, sizeof(throughput), "%9.0f tasks/s", count / elapsed);
+  }
+  printf("%-14s %17s  p50 %8.1f us  p99 %8.1f us  max %8.1f us\n", label, throughput,
+      waited[count / 2] * 1e6, waited[count * 99 / 100] * 1e6, waited[count - 1] * 1e6);
+}
+
+/* One task at a time, posted to a loop that went back to sleep: the cost
+ * of waking it up. */
+static void idle(inginxServer *server, int64_t count)
+{
+  int64_t idx;
+  executed = 0;
+  for (idx = 0; idx < count; ++idx) {
+    usleep(200);
+    posted[idx] = now();
+    inginxServerPost(server, execute, (void *) (intptr_t) idx);
+    waitExecuted(idx + 1);
+  }
+  report("idle wake up", count, 0);
+}
+
+static void flood(inginxServer *server, int32_t producers, int64_t count)
+{
+  producer *ps = calloc(producers, sizeof(producer));
+  char label[32];
+  double start;
+  int32_t idx;
+  executed = 0;
+  start = now();
+  for (idx = 0; idx < producers; ++idx) {
+    ps[idx].server = server;
+    ps[idx].first = count / producers * idx;
+    ps[idx].count = count / producers;
+    pthread_create(&ps[idx].thread, NULL, run, ps + idx);
+  }
+  for (idx = 0; idx < producers; ++idx) {
+    pthread_join(ps[idx].thread, NULL);
+  }
+  waitExecuted(count / producers * producers);
+  snprintf(label, sizeof(label), "%d producer%s", producers, producers > 1 ? "s" : "");
+  report(label, count / producers * producers, now() - start);
+  free(ps);
+}
+
+int main(int argc, char **argv)
+{
+  int32_t producers = argc > 1 ? atoi(argv[1]) : 4;
+  int64_t tasks = argc > 2 ? atoll(argv[2]) : 2000000;
+  inginxServer *server = inginxServerCreate();
+  pthread_t thread;
+
+  posted = malloc(tasks * sizeof(double));
+  waited = malloc(tasks * sizeof(double));
+  inginxServerConnectionLimit(server, 1024);
+  /* The worker only runs with a listener, nothing connects to it. */
+  if (inginxServerBind(server, "127.0.0.1:18282", 128) == NULL) {
+    fprintf(stderr, "Could not bind 127.0.0.1:%d\n", PORT);
+    return 1;
+  }
+  pthread_create(&thread, NULL, serve, server);
+  usleep(100000);
+
+  printf("post to execute on one worker, %lld tasks\n", (long long) tasks);
+  idle(server, 10000);
+  flood(server, 1, tasks);
+  if (producers > 1) {
+    flood(server, producers, tasks);
+  }
+
+  inginxServerShutdown(server);
+  pthread_join(thread, NULL);
+  inginxServerFree(server);
+  free(posted);
+  free(waited);
+  return 0;
+}
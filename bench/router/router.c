@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "router.h"
+
+#define ROUTES 1000
+
+/* What deployments write without a router: try every pattern in turn,
+ * segment by segment. */
+typedef struct linearRoute {
+  inginxMethod method;
+  char *pattern;
+} linearRoute;
+
+static int linearMatches(const char *pattern, const char *path, size_t length)
+{
+  const char *end = path + length, *next;
+  while (*pattern != '\0' && path < end) {
+    if (*pattern == '*') {
+      return 1;
+    }
+    if (*pattern == ':') {
+      if (*path == '/') {
+        return 0;
+      }
+      pattern += strcspn(pattern, "/");
+      next = memchr(path, '/', end - path);
+      path = next != NULL ? next : end;
+      continue;
+    }
+    if (*pattern++ != *path++) {
+      return 0;
+    }
+  }
+  return (*pattern == '\0' || *pattern == '*') && path == end;
+}
+
+static int32_t linearMatch(linearRoute *routes, int32_t count, inginxMethod method, const char *path, size_t length)
+{
+  int32_t idx;
+  for (idx = 0; idx < count; ++idx) {
+    if (routes[idx].method == method && linearMatches(routes[idx].pattern, path, length)) {
+      return idx;
+    }
+  }
+  return -1;
+}
+
+static void handler(inginxServer *s, inginxClient *c, inginxMessage *message, void *opaque)
+{
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Routes shaped like a REST api: resources with a collection, an item and
+ * nested collections, a few static pages and file trees. */
+static void makeRoute(int32_t idx, inginxMethod *method, char *pattern, size_t size, char *path, size_t pathSize)
+{
+  static const char *versions[] = {"v1", "v2", "beta"};
+  static const inginxMethod methods[] = {INGINX_METHOD_GET, INGINX_METHOD_POST, INGINX_METHOD_PUT, INGINX_METHOD_DELETE};
+  int32_t resource = idx / 8;
+  const char *version = versions[resource % 3];
+  *method = methods[idx % 4];
+  switch ((idx / 4) % 2 * 4 + idx % 4) {
+    case 0:
+    case 1:
+      snprintf(pattern, size, "/api/%s/resource%d", version, resource);
+      snprintf(path, pathSize, "/api/%s/resource%d", version, resource);
+      break;
+    case 2:
+    case 3:
+      snprintf(pattern, size, "/api/%s/resource%d/:id", version, resource);
+      snprintf(path, pathSize, "/api/%s/resource%d/%d", version, resource, idx * 7919);
+      break;
+    case 4:
+      snprintf(pattern, size, "/api/%s/resource%d/:id/children/:child", version, resource);
+      snprintf(path, pathSize, "/api/%s/resource%d/%d/children/c%d", version, resource, idx, idx * 31);
+      break;
+    case 5:
+      snprintf(pattern, size, "/api/%s/resource%d/:id/children", version, resource);
+      snprintf(path, pathSize, "/api/%s/resource%d/%d/children", version, resource, idx);
+      break;
+    case 6:
+      snprintf(pattern, size, "/pages/section%d/index.html", resource);
+      snprintf(path, pathSize, "/pages/section%d/index.html", resource);
+      break;
+    default:
+      snprintf(pattern, size, "/assets/tree%d/*path", resource);
+      snprintf(path, pathSize, "/assets/tree%d/css/site.%d.css", resource, idx);
+      break;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  int64_t rounds = argc > 1 ? atoll(argv[1]) : 2000;
+  inginxRouter *router = inginxRouterCreate();
+  linearRoute *linear = calloc(ROUTES, sizeof(linearRoute));
+  char **paths = calloc(ROUTES, sizeof(char *));
+  inginxMethod *methods = calloc(ROUTES, sizeof(inginxMethod));
+  inginxSlice values[ROUTE_MAX_PARAMETERS];
+  char pattern[256], path[256];
+  const inginxRoute *route;
+  int32_t idx, count, matched = 0;
+  int64_t round;
+  double start, radix, scan;
+
+  for (idx = 0; idx < ROUTES; ++idx) {
+    makeRoute(idx, methods + idx, pattern, sizeof(pattern), path, sizeof(path));
+    if (inginxRouterAdd(router, methods[idx], pattern, handler, (void *) (intptr_t) idx) != C_OK) {
+      fprintf(stderr, "Could not route %s\n", pattern);
+      return 1;
+    }
+    linear[idx].method = methods[idx];
+    linear[idx].pattern = strdup(pattern);
+    paths[idx] = strdup(path);
+  }
+
+  /* Both have to agree before being compared. */
+  for (idx = 0; idx < ROUTES; ++idx) {
+    route = inginxRouterMatch(router, methods[idx], paths[idx], strlen(paths[idx]), values, &count, NULL);
+    if (route == NULL || (intptr_t) route->opaque != idx || linearMatch(linear, ROUTES, methods[idx], paths[idx], strlen(paths[idx])) != idx) {
+      fprintf(stderr, "Mismatch on %s\n", paths[idx]);
+      return 1;
+    }
+  }
+
+  start = now();
+  for (round = 0; round < rounds; ++round) {
+    for (idx = 0; idx < ROUTES; ++idx) {
+      matched += inginxRouterMatch(router, methods[idx], paths[idx], strlen(paths[idx]), values, &count, NULL) != NULL;
+    }
+  }
+  radix = now() - start;
+
+  start = now();
+  for (round = 0; round < rounds / 20 + 1; ++round) {
+    for (idx = 0; idx < ROUTES; ++idx) {
+      matched += linearMatch(linear, ROUTES, methods[idx], paths[idx], strlen(paths[idx])) >= 0;
+    }
+  }
+  scan = (now() - start) * rounds / (rounds / 20 + 1);
+
+  printf("%d routes, %d matched\n", ROUTES, matched);
+  printf("radix  %8.1f ns/lookup\n", radix * 1e9 / (rounds * ROUTES));
+  printf("linear %8.1f ns/lookup\n", scan * 1e9 / (rounds * ROUTES));
+
+  for (idx = 0; idx < ROUTES; ++idx) {
+    free(linear[idx].pattern);
+    free(paths[idx]);
+  }
+  free(linear);
+  free(paths);
+  free(methods);
+  inginxRouterFree(router);
+  return 0;
+}
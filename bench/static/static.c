@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <inginx.h>
+
+#define PORT 18281
+#define SMALL_FILES 64
+#define SMALL_SIZE 2048
+#define LARGE_FILES 48
+#define LARGE_SIZE (1024 * 1024)
+
+typedef struct connection {
+  pthread_t thread;
+  int fd;
+  const char *prefix;
+  const char *name;
+  int32_t files;
+  int64_t requests;
+  int64_t bytes;
+  int32_t seed;
+} connection;
+
+static void *serve(void *server)
+{
+  inginxServerMain(server);
+  return NULL;
+}
+
+static int connectServer(void)
+{
+  int one = 1;
+  struct sockaddr_in address;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(PORT);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, (struct sockaddr *) &address, sizeof(address)) != 0) {
+    perror("connect");
+    exit(1);
+  }
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+/* Read one response, return the length of its body. */
+static int64_t readResponse(int fd, char *buffer, size_t size)
+{
+  size_t length = 0;
+  ssize_t nread;
+  char *end, *header;
+  int64_t body;
+  while (1) {
+    if ((nread = read(fd, buffer + length, size - length - 1)) <= 0) {
+      perror("read");
+      exit(1);
+    }
+    length += nread;
+    buffer[length] = '\0';
+    if ((end = strstr(buffer, "\r\n\r\n")) != NULL) {
+      break;
+    }
+  }
+  if (strncmp(buffer, "HTTP/1.1 200", 12) != 0 || (header = strstr(buffer, "Content-Length: ")) == NULL) {
+    fprintf(stderr, "Unexpected response %.*s\n", (int) (end - buffer), buffer);
+    exit(1);
+  }
+  body = atoll(header + 16);
+  length -= end + 4 - buffer;
+  while ((int64_t) length < body) {
+    if ((nread = read(fd, buffer, size)) <= 0) {
+      perror("read");
+      exit(1);
+    }
+    length += nread;
+  }
+  return body;
+}
+
+/* Ask for random files of the set, one at a time. */
+static void *run(void *arg)
+{
+  connection *conn = arg;
+  char request[256], *buffer = malloc(256 * 1024);
+  int64_t idx;
+  int length;
+  for (idx = 0; idx < conn->requests; ++idx) {
+    conn->seed = conn->seed * 1103515245 + 12345;
+    length = snprintf(request, sizeof(request), "GET %s/%s%d.bin HTTP/1.1\r\nHost: localhost\r\n\r\n",
+        conn->prefix, conn->name, (conn->seed >> 8 & 0x7fffff) % conn->files);
+    if (write(conn->fd, request, length) != length) {
+      perror("write");
+      exit(1);
+    }
+    conn->bytes += readResponse(conn->fd, buffer, 256 * 1024);
+  }
+  free(buffer);
+  return NULL;
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void writeFiles(const char *directory, const char *name, int32_t count, size_t size)
+{
+  char path[512], *data = malloc(size);
+  int32_t idx;
+  FILE *file;
+  memset(data, 'x', size);
+  for (idx = 0; idx < count; ++idx) {
+    snprintf(path, sizeof(path), "%s/%s%d.bin", directory, name, idx);
+    if ((file = fopen(path, "w")) == NULL || fwrite(data, 1, size, file) != size) {
+      perror(path);
+      exit(1);
+    }
+    fclose(file);
+  }
+  free(data);
+}
+
+static void bench(connection *conns, int32_t connections, const char *label, const char *prefix, const char *name,
+    int32_t files, int64_t requests)
+{
+  int32_t idx;
+  int64_t bytes = 0;
+  double start = now(), elapsed;
+  for (idx = 0; idx < connections; ++idx) {
+    conns[idx].prefix = prefix;
+    conns[idx].name = name;
+    conns[idx].files = files;
+    conns[idx].requests = requests / connections;
+    conns[idx].bytes = 0;
+    conns[idx].seed = idx + 1;
+    pthread_create(&conns[idx].thread, NULL, run, conns + idx);
+  }
+  for (idx = 0; idx < connections; ++idx) {
+    pthread_join(conns[idx].thread, NULL);
+    bytes += conns[idx].bytes;
+  }
+  elapsed = now() - start;
+  printf("%-28s %9.0f requests/s %8.2f GB/s\n", label, requests / connections * connections / elapsed, bytes / elapsed / 1e9);
+}
+
+int main(int argc, char **argv)
+{
+  int32_t connections = argc > 1 ? atoi(argv[1]) : 4;
+  int64_t requests = argc > 2 ? atoll(argv[2]) : 200000;
+  char directory[] = "/tmp/inginx-static-XXXXXX", command[64];
+  connection *conns = calloc(connections, sizeof(connection));
+  pthread_t thread;
+  inginxServer *server;
+  int32_t idx;
+
+  if (mkdtemp(directory) == NULL) {
+    perror("mkdtemp");
+    return 1;
+  }
+  writeFiles(directory, "small", SMALL_FILES, SMALL_SIZE);
+  writeFiles(directory, "large", LARGE_FILES, LARGE_SIZE);
+
+  /* The same files behind caches of different sizes: every hot file
+   * cached, a single one so every request opens its file, and a few of
+   * the large ones. */
+  server = inginxServerCreate();
+  inginxServerConnectionLimit(server, 1024);
+  if (inginxServerBind(server, "127.0.0.1:18281", 128) == NULL) {
+    fprintf(stderr, "Could not bind 127.0.0.1:%d\n", PORT);
+    return 1;
+  }
+  inginxServerStatic(server, "/cached", directory, 0);
+  inginxServerStatic(server, "/uncached", directory, 1);
+  inginxServerStatic(server, "/cold", directory, LARGE_FILES / 6);
+  pthread_create(&thread, NULL, serve, server);
+  usleep(100000);
+  for (idx = 0; idx < connections; ++idx) {
+    conns[idx].fd = connectServer();
+  }
+
+  printf("%d connections, %d hot files of %d bytes, %d cold files of %d bytes\n", connections,
+      SMALL_FILES, SMALL_SIZE, LARGE_FILES, LARGE_SIZE);
+  bench(conns, connections, "hot set, cached", "/cached", "small", SMALL_FILES, requests);
+  bench(conns, connections, "hot set, open per request", "/uncached", "small", SMALL_FILES, requests);
+  bench(conns, connections, "cold set, cached", "/cached", "large", LARGE_FILES, requests / 20);
+  bench(conns, connections, "cold set, 1 in 6 cached", "/cold", "large", LARGE_FILES, requests / 20);
+
+  for (idx = 0; idx < connections; ++idx) {
+    close(conns[idx].fd);
+  }
+  inginxServerShutdown(server);
+  pthread_join(thread, NULL);
+  inginxServerFree(server);
+  free(conns);
+  snprintf(command, sizeof(command), "rm -rf %s", directory);
+  return system(command) != 0;
+}
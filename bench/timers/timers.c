@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "ae.h"
+
+static int32_t fired;
+
+static int expire(struct aeEventLoop *loop, long long id, void *data)
+{
+  ++fired;
+  return AE_NOMORE;
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Arm count timers between 60 and 120 seconds ahead, as idle connection
+ * timeouts would be, so that none of them fires during the run. */
+static void arm(aeEventLoop *loop, long long *ids, int32_t count)
+{
+  int32_t idx, seed = 1;
+  for (idx = 0; idx < count; ++idx) {
+    seed = seed * 1103515245 + 12345;
+    ids[idx] = aeCreateTimeEvent(loop, 60000 + (seed >> 8 & 0x7fffff) % 60000, expire, NULL, NULL);
+    if (ids[idx] == AE_ERR) {
+      fprintf(stderr, "Could not create timer %d\n", idx);
+      exit(1);
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  int32_t timers = argc > 1 ? atoi(argv[1]) : 100000;
+  int32_t iterations = argc > 2 ? atoi(argv[2]) : 100000;
+  long long *ids = malloc(timers * sizeof(long long));
+  aeEventLoop *loop = aeCreateEventLoop(1024);
+  double start, create, iterate, remove, due;
+  int32_t idx;
+
+  start = now();
+  arm(loop, ids, timers);
+  create = now() - start;
+
+  /* Nothing is due: what every iteration of a worker pays for its
+   * pending timeouts. */
+  start = now();
+  for (idx = 0; idx < iterations; ++idx) {
+    aeProcessEvents(loop, AE_ALL_EVENTS | AE_DONT_WAIT);
+  }
+  iterate = now() - start;
+
+  start = now();
+  for (idx = 0; idx < timers; ++idx) {
+    aeDeleteTimeEvent(loop, ids[idx]);
+  }
+  remove = now() - start;
+  aeProcessEvents(loop, AE_TIME_EVENTS | AE_DONT_WAIT);
+
+  /* Every timer due at once. */
+  for (idx = 0; idx < timers; ++idx) {
+    aeCreateTimeEvent(loop, 0, expire, NULL, NULL);
+  }
+  start = now();
+  while (fired < timers) {
+    aeProcessEvents(loop, AE_TIME_EVENTS | AE_DONT_WAIT);
+  }
+  due = now() - start;
+
+  printf("%d timers on %s\n", timers, aeGetApiName());
+  printf("aeCreateTimeEvent  %10.1f ns\n", create * 1e9 / timers);
+  printf("loop iteration     %10.1f ns\n", iterate * 1e9 / iterations);
+  printf("aeDeleteTimeEvent  %10.1f ns\n", remove * 1e9 / timers);
+  printf("expire             %10.1f ns/timer\n", due * 1e9 / timers);
+
+  aeDeleteEventLoop(loop);
+  free(ids);
+  return 0;
+}
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include <inginx.h>
+#include "networking.h"
+#include "zmalloc.h"
+
+/* The decoder inginx had before, appending byte after byte to an sds, kept
+ * to compare against. */
+static const char *decodeBytewise(const char *src, int32_t len, sds *out)
+{
+#define H2I(x) (isdigit(x) ? x - '0' : x - 'W')
+  char chr, dst;
+  int32_t idx, hi, lo, queryString = 0;
+  sds decoded = NULL;
+  for (idx = 0; idx < len; idx++) {
+    switch ((chr = src[idx])) {
+      case '%':
+        if (idx < len - 2 && isxdigit((hi = src[idx + 1])) && isxdigit((lo = src[idx + 2]))) {
+          hi = tolower(hi), lo = tolower(lo);
+          if (decoded == NULL) {
+            decoded = sdsnewlen(src, idx);
+          }
+          dst = (char) ((H2I(hi) << 4) | H2I(lo));
+          idx += 2;
+          decoded = sdscatlen(decoded, &dst, 1);
+        } else {
+          sdsfree(decoded);
+          return NULL;
+        }
+        break;
+      case '+':
+        if (queryString) {
+          if (decoded == NULL) {
+            decoded = sdsnewlen(src, idx);
+          }
+          decoded = sdscatlen(decoded, " ", 1);
+          break;
+        }
+        goto append;
+      case '?':
+        queryString = 1;
+        /* FALL THROUGH */
+      default:
+append:
+        if (decoded != NULL) {
+          decoded = sdscatlen(decoded, src + idx, 1);
+        }
+    }
+  }
+  *out = decoded;
+  return decoded != NULL ? decoded : src;
+#undef H2I
+}
+
+static char *makeUrl(const char *kind, size_t length)
+{
+  static const char *utf8 = "%E6%97%A5%E6%9C%AC%E8%AA%9E";
+  char *url = malloc(length + 64);
+  size_t pos = 0;
+  int32_t idx = 0;
+  if (strcmp(kind, "path") == 0) {
+    /* Non ASCII file names, nearly every byte escaped */
+    pos += sprintf(url, "/files/");
+    while (pos < length) {
+      idx++;
+      pos += sprintf(url + pos, "%s%s", utf8, (idx % 4) ? "%20" : "/");
+    }
+  } else if (strcmp(kind, "query") == 0) {
+    /* Form submitted with GET: spaces as '+', punctuation escaped */
+    pos += sprintf(url, "/search?");
+    while (pos < length) {
+      pos += sprintf(url + pos, "%sq%d=hello+world%%21+caf%%C3%%A9+%%26+more", idx ? "&" : "", idx);
+      idx++;
+    }
+  } else {
+    /* Long and mostly clean, a few escapes */
+    pos += sprintf(url, "/static/assets/");
+    while (pos < length) {
+      idx++;
+      pos += sprintf(url + pos, "%s-component-bundle-v%d", (idx % 8) ? "" : "%2B", idx);
+    }
+  }
+  url[pos] = '\0';
+  return url;
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+  static const char *kinds[] = {"path", "query", "clean"};
+  size_t length = argc > 1 ? (size_t) atol(argv[1]) : 2048;
+  int32_t rounds = argc > 2 ? atoi(argv[2]) : 200000, round, idx;
+  inginxMessage message;
+  const char *decoded, *expected;
+  double start, bytewise, current;
+  sds reference;
+  char *url;
+
+  printf("%zu bytes per url, %d rounds\n", length, rounds);
+  for (idx = 0; idx < (int32_t) (sizeof(kinds) / sizeof(kinds[0])); ++idx) {
+    url = makeUrl(kinds[idx], length);
+    memset(&message, 0, sizeof(message));
+    message.base = url;
+    message.url.length = strlen(url);
+
+    reference = NULL;
+    expected = decodeBytewise(url, message.url.length, &reference);
+    decoded = inginxMessageUrlDecoded(&message);
+    if (expected == NULL || decoded == NULL || strcmp(expected, decoded) != 0) {
+      fprintf(stderr, "%s: decoded urls differ\n", kinds[idx]);
+      return 1;
+    }
+    sdsfree(reference);
+
+    start = now();
+    for (round = 0; round < rounds; ++round) {
+      reference = NULL;
+      decodeBytewise(url, message.url.length, &reference);
+      sdsfree(reference);
+    }
+    bytewise = now() - start;
+    start = now();
+    for (round = 0; round < rounds; ++round) {
+      message.urlDecoded = NULL;
+      inginxMessageUrlDecoded(&message);
+    }
+    current = now() - start;
+    printf("%-6s bytewise %8.1f ns/url %7.1f MB/s, decoder %8.1f ns/url %7.1f MB/s\n", kinds[idx],
+        bytewise / rounds * 1e9, (double) message.url.length * rounds / bytewise / 1e6,
+        current / rounds * 1e9, (double) message.url.length * rounds / current / 1e6);
+    zfree(message.decoded);
+    free(url);
+  }
+  return 0;
+}
@@ -1,6 +1,10 @@
 #ifndef __INGINX_H__
 #define __INGINX_H__
 
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -8,6 +12,7 @@ extern "C" {
 typedef struct inginxServer inginxServer;
 typedef struct inginxClient inginxClient;
 typedef struct inginxMessage inginxMessage;
+typedef struct inginxRequest inginxRequest;
 typedef struct inginxClient inginxClient;
 
 typedef enum inginxLogLevel
@@ -31,9 +36,18 @@ typedef enum inginxEventType
   INGINX_EVENT_TYPE_RESPONSE = 1 << 3,
   INGINX_EVENT_TYPE_ERROR = 1 << 4,
   INGINX_EVENT_TYPE_DESTROYED = 1 << 5,
+  INGINX_EVENT_TYPE_BODY_CHUNK = 1 << 6,
   INGINX_EVENT_TYPE_ALL = 0xFFFFFFFF,
 } inginxEventType;
 
+/* Event data of INGINX_EVENT_TYPE_BODY_CHUNK, the bytes point into the input
+ * of the client and are only valid during the call. */
+typedef struct inginxBodyChunk {
+  inginxMessage *message; /* head of the request, without a body */
+  const char *data;
+  size_t length;
+} inginxBodyChunk;
+
 typedef void (*inginxListener)(inginxServer *s, inginxClient *c, inginxEventType type, void *eventData, void *opaque);
 
 typedef enum inginxMethod {
@@ -78,15 +92,64 @@ typedef enum inginxMethod {
   INGINX_METHOD_UNLINK = 32
 } inginxMethod;
 
+/* Well-known request headers, looked up without comparing names. */
+typedef enum inginxHeaderId {
+  INGINX_HEADER_UNKNOWN = 0,
+  INGINX_HEADER_ACCEPT = 1,
+  INGINX_HEADER_ACCEPT_CHARSET = 2,
+  INGINX_HEADER_ACCEPT_ENCODING = 3,
+  INGINX_HEADER_ACCEPT_LANGUAGE = 4,
+  INGINX_HEADER_AUTHORIZATION = 5,
+  INGINX_HEADER_CACHE_CONTROL = 6,
+  INGINX_HEADER_CONNECTION = 7,
+  INGINX_HEADER_CONTENT_ENCODING = 8,
+  INGINX_HEADER_CONTENT_LENGTH = 9,
+  INGINX_HEADER_CONTENT_TYPE = 10,
+  INGINX_HEADER_COOKIE = 11,
+  INGINX_HEADER_EXPECT = 12,
+  INGINX_HEADER_FORWARDED = 13,
+  INGINX_HEADER_HOST = 14,
+  INGINX_HEADER_IF_MATCH = 15,
+  INGINX_HEADER_IF_MODIFIED_SINCE = 16,
+  INGINX_HEADER_IF_NONE_MATCH = 17,
+  INGINX_HEADER_IF_RANGE = 18,
+  INGINX_HEADER_IF_UNMODIFIED_SINCE = 19,
+  INGINX_HEADER_ORIGIN = 20,
+  INGINX_HEADER_PRAGMA = 21,
+  INGINX_HEADER_RANGE = 22,
+  INGINX_HEADER_REFERER = 23,
+  INGINX_HEADER_TRANSFER_ENCODING = 24,
+  INGINX_HEADER_UPGRADE = 25,
+  INGINX_HEADER_USER_AGENT = 26,
+  INGINX_HEADER_X_FORWARDED_FOR = 27,
+  INGINX_HEADER_X_FORWARDED_PROTO = 28,
+  INGINX_HEADER_X_REAL_IP = 29,
+  INGINX_HEADER_X_REQUESTED_WITH = 30,
+  INGINX_HEADER_COUNT = 31
+} inginxHeaderId;
+
 uint16_t inginxMessageStatus(const inginxMessage *message);
 inginxMethod inginxMessageMethod(const inginxMessage *message);
 const char* inginxMessageUrl(const inginxMessage *message);
 const char *inginxMessageHeader(const inginxMessage *message, const char *field);
 const char *inginxMessageHeaderNext(const inginxMessage *message, const char *field, const char *cursor);
+/* INGINX_HEADER_UNKNOWN for names outside inginxHeaderId. */
+inginxHeaderId inginxHeaderLookup(const char *field);
+const char *inginxHeaderName(inginxHeaderId id);
+const char *inginxMessageHeaderById(const inginxMessage *message, inginxHeaderId id);
+const char *inginxMessageHeaderByIdNext(const inginxMessage *message, inginxHeaderId id, const char *cursor);
 const char *inginxMessageBody(const inginxMessage *message);
 size_t inginxMessageBodyLength(const inginxMessage *message);
 const char *inginxMessageUrlDecoded(const inginxMessage *message);
+/* Parameters of the query string, split once on first use. Names and values
+ * are decoded and stay valid as long as the message. */
+int32_t inginxMessageParameterCount(const inginxMessage *message);
+const char *inginxMessageParameterName(const inginxMessage *message, int32_t index);
+const char *inginxMessageParameterValue(const inginxMessage *message, int32_t index);
+/* Index of the first parameter named name from index from on, -1 if none. */
+int32_t inginxMessageParameterFind(const inginxMessage *message, const char *name, int32_t from);
 const char *inginxMessageParameter(const inginxMessage *message, const char *name);
+/* The next value of name after cursor, a value returned before or NULL. */
 const char *inginxMessageParameterNext(const inginxMessage *message, const char *name, const char *cursor);
 void inginxMessageVersion(const inginxMessage *message, uint16_t *major, uint16_t *minor);
 
@@ -94,6 +157,23 @@ const char *inginxVersion(void);
 
 inginxServer *inginxServerCreate(void);
 inginxServer *inginxServerHz(inginxServer *server, int32_t hz);
+/* Timeouts in milliseconds, 0 disables. Header: from the first byte of a request
+ * to the end of its headers. Body: between two reads of the body. Idle: waiting
+ * for the next request on a keep-alive connection. Write: without any progress
+ * sending a response. The connection is closed when one expires. */
+inginxServer *inginxServerHeaderTimeout(inginxServer *server, int32_t ms);
+inginxServer *inginxServerBodyTimeout(inginxServer *server, int32_t ms);
+inginxServer *inginxServerIdleTimeout(inginxServer *server, int32_t ms);
+inginxServer *inginxServerWriteTimeout(inginxServer *server, int32_t ms);
+/* Request limits, 0 disables. A request exceeding one is answered right away
+ * and the connection closed: 414 for the url, 431 for the bytes of the headers
+ * or their number, 413 for the body. An announced Content-Length over the
+ * limit is rejected before any of the body is read. Defaults: 8 KB of url,
+ * 32 KB and 100 headers, 16 MB of body. */
+inginxServer *inginxServerMaxUrlLength(inginxServer *server, int32_t bytes);
+inginxServer *inginxServerMaxHeaderBytes(inginxServer *server, int32_t bytes);
+inginxServer *inginxServerMaxHeaderCount(inginxServer *server, int32_t count);
+inginxServer *inginxServerMaxBodySize(inginxServer *server, int64_t bytes);
 inginxServer *inginxServerGroupCreate(int32_t size, int32_t useProcess);
 inginxServer *inginxServerBind(inginxServer *server, const char *address, int32_t backlog);
 inginxServer *inginxServerConnectionLimit(inginxServer *server, int32_t limit);
@@ -103,6 +183,18 @@ inginxServer *inginxServerLogger(inginxServer *server, inginxLogger logger, ingi
 inginxServer *inginxServerListener(inginxServer *server, inginxListener listener, int32_t mask, void *opaque);
 inginxServer *inginxServerStrict(inginxServer *server);
 inginxServer *inginxServerRelaxed(inginxServer *server);
+inginxServer *inginxServerCompletion(inginxServer *server);
+/* Deliver request bodies piece by piece as BODY_CHUNK events instead of
+ * collecting them, the REQUEST event follows the last one with an empty body. */
+inginxServer *inginxServerBodyStreaming(inginxServer *server);
+
+typedef struct inginxPoolStats {
+  int64_t allocated; /* objects taken from the allocator */
+  int64_t reused;    /* objects served from the pool */
+  int64_t idle;      /* objects waiting in the pool */
+} inginxPoolStats;
+/* Sum over every worker, approximate while the server is running */
+int32_t inginxServerClientPoolStats(inginxServer *server, inginxPoolStats *stats);
 void inginxServerSimpleLogger(inginxServer *s, inginxLogLevel level, const char *func, const char *file, uint32_t line, const char *log, void *opaque);
 void inginxServerFree(inginxServer *inginxServer);
 
@@ -118,6 +210,11 @@ int32_t inginxServerDeleteFileEvent(inginxServer *server, int32_t fd, int32_t ma
 int32_t inginxServerGetFileEvents(inginxServer *server, int32_t fd);
 int32_t inginxServerConnect(inginxServer *server, const char *addr, uint16_t port);
 
+typedef void (*inginxTask)(inginxServer *server, void *opaque);
+/* Run task on the thread of the server event loop, safe to call from any thread.
+ * Posting to a group runs the task once on every worker. */
+int32_t inginxServerPost(inginxServer *server, inginxTask task, void *opaque);
+
 int32_t inginxClientGetRemoteAddress(inginxClient *client, char *address, size_t size, uint16_t *port);
 int32_t inginxClientGetLocalAddress(inginxClient *client, char *address, size_t size, uint16_t *port);
 void inginxClientSetStatus(inginxClient *c, int32_t status);
@@ -143,7 +240,77 @@ void inginxClientAddReplyPrintf(inginxClient *c, const char *fmt, ...);
 void inginxClientAddBodyPrintf(inginxClient *c, const char *fmt, ...);
 #endif
 
+/* Write replies in place: inginxClientReserve() returns room for at least
+ * size bytes at the end of the reply, in the output buffer or its last
+ * block, storing how much there is in available, and
+ * inginxClientCommit() appends the first length bytes written there. No
+ * other reply can be added in between. NULL if the client doesn't take
+ * replies anymore. */
+char *inginxClientReserve(inginxClient *c, size_t size, size_t *available);
+void inginxClientCommit(inginxClient *c, size_t length);
+
+/* Send length bytes of fd from offset as the body, without copying them
+ * through memory where sendfile() is available. Content-Length is added if
+ * it wasn't yet. The fd is taken over: closed once the range was sent or
+ * the client is gone, or handed to release instead when one is given. */
+typedef void (*inginxFileRelease)(inginxServer *s, int fd, void *opaque);
+int32_t inginxClientSendFile(inginxClient *c, int fd, int64_t offset, size_t length);
+int32_t inginxClientSendFileRelease(inginxClient *c, int fd, int64_t offset, size_t length, inginxFileRelease release, void *opaque);
+
 void inginxClientClose(inginxClient *c);
+/* Stop reading and parsing the input of the client until resumed, for instance
+ * to apply backpressure from a BODY_CHUNK listener. Timeouts are not enforced
+ * while paused. With completion based I/O the receive is cancelled, what the
+ * kernel already received is held back. */
+void inginxClientPauseReading(inginxClient *c);
+void inginxClientResumeReading(inginxClient *c);
+
+/* Deferred responses: called from the REQUEST listener, inginxClientDefer() takes
+ * the message away from the client (the event data is left empty) and returns a
+ * request holding one reference. The response is built later by completion, run
+ * on the event loop of the client after inginxRequestComplete() was called from
+ * any thread. Completion gets a NULL client if it disconnected in the meantime.
+ * Pipelined requests are held back until the deferred one was answered; a request
+ * released without being completed is answered with 500. */
+typedef void (*inginxRequestCompletion)(inginxServer *s, inginxClient *c, inginxMessage *message, void *opaque);
+inginxRequest *inginxClientDefer(inginxClient *c);
+inginxMessage *inginxRequestMessage(inginxRequest *r);
+inginxRequest *inginxRequestRetain(inginxRequest *r);
+void inginxRequestRelease(inginxRequest *r);
+/* Consumes the reference of the caller */
+int32_t inginxRequestComplete(inginxRequest *r, inginxRequestCompletion completion, void *opaque);
+
+/* Offloading: start a pool of threads shared by every worker of the server, with
+ * room for depth queued requests. inginxClientOffload() defers the request, runs
+ * work on a pool thread and then completion on the event loop of the client. If
+ * the queue is full the client is answered 503 right away and C_ERR returned;
+ * without a pool both run inline. */
+typedef void (*inginxOffloadWork)(inginxMessage *message, void *opaque);
+inginxServer *inginxServerOffload(inginxServer *server, int32_t threads, int32_t depth);
+int32_t inginxClientOffload(inginxClient *c, inginxOffloadWork work, inginxRequestCompletion completion, void *opaque);
+
+/* Routing: requests are matched on the path of their url against patterns of
+ * static bytes, :name segments matching one segment and a last *name segment
+ * matching the rest of the path, static bytes first, then :name, then *name.
+ * A matched request goes to the handler of its method instead of the listener.
+ * Others still reach a listener taking REQUEST events, without one they are
+ * answered 404, or 405 if the path is routed for other methods. Routes are
+ * added before the server runs and shared by every worker of the group. */
+typedef void (*inginxRouteHandler)(inginxServer *s, inginxClient *c, inginxMessage *message, void *opaque);
+inginxServer *inginxServerRoute(inginxServer *server, inginxMethod method, const char *pattern, inginxRouteHandler handler, void *opaque);
+/* Parameters of the matched route in pattern order, values point into the
+ * url, raw and not NUL terminated. */
+int32_t inginxMessageRouteParameterCount(const inginxMessage *message);
+const char *inginxMessageRouteParameterName(const inginxMessage *message, int32_t index);
+const char *inginxMessageRouteParameterValue(const inginxMessage *message, int32_t index, size_t *length);
+const char *inginxMessageRouteParameter(const inginxMessage *message, const char *name, size_t *length);
+
+/* Serve the files below root for GET and HEAD of the paths under prefix,
+ * through a wildcard route. Every worker keeps up to cacheSize files open
+ * with their size, modification time and ETag, 0 for the default of 1024,
+ * dropping them as inotify reports changes to their directory. Bodies are
+ * sent with inginxClientSendFile(), conditional requests answered 304. */
+inginxServer *inginxServerStatic(inginxServer *server, const char *prefix, const char *root, int32_t cacheSize);
 
 #ifdef __cplusplus
 }
@@ -39,12 +39,20 @@
 #include <poll.h>
 #include <time.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 
 #include "ae.h"
 #include "zmalloc.h"
 
 /* Include the best multiplexing layer supported by this system.
  * The following should be ordered by performances, descending. */
+#ifdef HAVE_IOURING
+#include "ae_iouring.c"
+#else
 #ifdef HAVE_EVPORT
 #include "ae_evport.c"
 #else
@@ -62,6 +70,40 @@
         #endif
     #endif
 #endif
+#endif
+
+static void aeProcessPostedTasks(aeEventLoop *eventLoop, int fd, void *clientData, int mask);
+
+/* Create the descriptor used to wake up the loop from other threads: an
+ * eventfd where available, a non blocking pipe otherwise. */
+static int aeCreatePostChannel(aeEventLoop *eventLoop) {
+#ifdef __linux__
+    int fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+
+    if (fd == -1) return AE_ERR;
+    eventLoop->postFd[0] = eventLoop->postFd[1] = fd;
+#else
+    int j;
+
+    if (pipe(eventLoop->postFd) == -1) return AE_ERR;
+    for (j = 0; j < 2; j++) {
+        fcntl(eventLoop->postFd[j], F_SETFL,
+              fcntl(eventLoop->postFd[j], F_GETFL) | O_NONBLOCK);
+        fcntl(eventLoop->postFd[j], F_SETFD, FD_CLOEXEC);
+    }
+#endif
+    if (aeCreateFileEvent(eventLoop, eventLoop->postFd[0], AE_READABLE,
+            aeProcessPostedTasks, NULL) == AE_ERR) {
+        return AE_ERR;
+    }
+    return AE_OK;
+}
+
+static void aeClosePostChannel(aeEventLoop *eventLoop) {
+    if (eventLoop->postFd[0] != -1) close(eventLoop->postFd[0]);
+    if (eventLoop->postFd[1] != eventLoop->postFd[0]) close(eventLoop->postFd[1]);
+    eventLoop->postFd[0] = eventLoop->postFd[1] = -1;
+}
 
 aeEventLoop *aeCreateEventLoop(int setsize) {
     aeEventLoop *eventLoop;
@@ -73,16 +115,30 @@ aeEventLoop *aeCreateEventLoop(int setsize) {
     if (eventLoop->events == NULL || eventLoop->fired == NULL) goto err;
     eventLoop->setsize = setsize;
     eventLoop->lastTime = time(NULL);
-    eventLoop->timeEventHead = NULL;
+    eventLoop->timeEventHeap = NULL;
+    eventLoop->timeEventCount = 0;
+    eventLoop->timeEventSize = 0;
+    eventLoop->timeEventTable = NULL;
+    eventLoop->timeEventFreeSlots = NULL;
+    eventLoop->timeEventFreeCount = 0;
+    eventLoop->timeEventFired = NULL;
+    eventLoop->timeEventDeleted = NULL;
     eventLoop->timeEventNextId = 0;
     eventLoop->stop = 0;
     eventLoop->maxfd = -1;
     eventLoop->beforesleep = NULL;
+    eventLoop->postHead = NULL;
+    eventLoop->postFd[0] = eventLoop->postFd[1] = -1;
     if (aeApiCreate(eventLoop) == -1) goto err;
     /* Events with mask == AE_NONE are not set. So let's initialize the
      * vector with it. */
     for (i = 0; i < setsize; i++)
         eventLoop->events[i].mask = AE_NONE;
+    if (aeCreatePostChannel(eventLoop) == AE_ERR) {
+        aeClosePostChannel(eventLoop);
+        aeApiFree(eventLoop);
+        goto err;
+    }
     return eventLoop;
 
 err:
@@ -124,16 +180,27 @@ int aeResizeSetSize(aeEventLoop *eventLoop, int setsize) {
     return AE_OK;
 }
 
+static void aeFreeDeletedTimeEvents(aeEventLoop *eventLoop);
+
 void aeDeleteEventLoop(aeEventLoop *eventLoop) {
-    aeTimeEvent *te = eventLoop->timeEventHead, *next;
-    while (te) {
-        next = te->next;
+    int j;
+
+    /* Tasks may own resources, run whatever is still queued. */
+    aeProcessPostedTasks(eventLoop, eventLoop->postFd[0], NULL, AE_READABLE);
+    aeClosePostChannel(eventLoop);
+
+    for (j = 0; j < eventLoop->timeEventCount; j++) {
+        aeTimeEvent *te = eventLoop->timeEventHeap[j];
         if (te->finalizerProc) {
             te->finalizerProc(eventLoop, te->clientData);
         }
         zfree(te);
-        te = next;
     }
+    aeFreeDeletedTimeEvents(eventLoop);
+    zfree(eventLoop->timeEventHeap);
+    zfree(eventLoop->timeEventTable);
+    zfree(eventLoop->timeEventFreeSlots);
+    zfree(eventLoop->timeEventFired);
     aeApiFree(eventLoop);
     zfree(eventLoop->events);
     zfree(eventLoop->fired);
@@ -144,6 +211,59 @@ void aeStop(aeEventLoop *eventLoop) {
     eventLoop->stop = 1;
 }
 
+void aePost(aeEventLoop *eventLoop, aePostProc *proc, void *clientData) {
+    aePostedTask *task, *head;
+    uint64_t one = 1;
+
+    task = zmalloc(sizeof(*task));
+    task->proc = proc;
+    task->clientData = clientData;
+    head = __atomic_load_n(&eventLoop->postHead, __ATOMIC_RELAXED);
+    do {
+        task->next = head;
+    } while (!__atomic_compare_exchange_n(&eventLoop->postHead, &head, task, 1,
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    /* Only the producer that finds the stack empty has to wake up the loop,
+     * the others are picked up by the same drain. */
+    if (head == NULL) {
+#ifdef __linux__
+        if (write(eventLoop->postFd[1], &one, sizeof(one)) == -1) {
+#else
+        if (write(eventLoop->postFd[1], &one, 1) == -1) {
+#endif
+            /* EAGAIN: a wake up is pending already. */
+        }
+    }
+}
+
+/* Drain the wake up descriptor, then grab every posted task at once and run
+ * them in posting order. Draining first guarantees that a task pushed after
+ * the exchange leaves the descriptor readable for the next iteration. */
+static void aeProcessPostedTasks(aeEventLoop *eventLoop, int fd, void *clientData, int mask) {
+    aePostedTask *task, *next, *tasks = NULL;
+    char buf[64];
+
+    AE_NOTUSED(clientData);
+    AE_NOTUSED(mask);
+    if (fd != -1) {
+        while (read(fd, buf, sizeof(buf)) > 0);
+    }
+    task = __atomic_exchange_n(&eventLoop->postHead, NULL, __ATOMIC_ACQUIRE);
+    while (task) {
+        next = task->next;
+        task->next = tasks;
+        tasks = task;
+        task = next;
+    }
+    while (tasks) {
+        task = tasks;
+        tasks = task->next;
+        task->proc(eventLoop, task->clientData);
+        zfree(task);
+    }
+}
+
 int aeCreateFileEvent(aeEventLoop *eventLoop, int fd, int mask,
         aeFileProc *proc, void *clientData)
 {
@@ -212,36 +332,161 @@ static void aeAddMillisecondsToNow(long long milliseconds, long *sec, long *ms)
     *ms = when_ms;
 }
 
+/* Time events live in a binary min-heap ordered by expire time, so the
+ * nearest timer is always at the root and insertion or removal costs
+ * O(log(N)). Every event also owns a slot in timeEventTable: the low
+ * AE_TIME_EVENT_SLOT_BITS of the id select the slot and the high bits are
+ * a serial number, so aeDeleteTimeEvent() resolves an id in O(1) and a
+ * stale id whose slot has been reused is simply not found. */
+#define AE_TIME_EVENT_SLOT_BITS 24
+#define AE_TIME_EVENT_SLOT_MASK ((1LL<<AE_TIME_EVENT_SLOT_BITS)-1)
+#define AE_TIME_EVENT_MAX_SLOTS (1<<AE_TIME_EVENT_SLOT_BITS)
+
+static inline int aeTimeEventBefore(aeTimeEvent *a, aeTimeEvent *b) {
+    return a->when_sec < b->when_sec ||
+        (a->when_sec == b->when_sec && a->when_ms < b->when_ms);
+}
+
+static inline void aeTimeEventHeapSet(aeEventLoop *eventLoop, int idx, aeTimeEvent *te) {
+    eventLoop->timeEventHeap[idx] = te;
+    te->heapIndex = idx;
+}
+
+static void aeTimeEventSiftUp(aeEventLoop *eventLoop, int idx) {
+    aeTimeEvent **heap = eventLoop->timeEventHeap;
+    aeTimeEvent *te = heap[idx];
+
+    while (idx > 0) {
+        int parent = (idx-1)/2;
+        if (!aeTimeEventBefore(te, heap[parent])) break;
+        aeTimeEventHeapSet(eventLoop, idx, heap[parent]);
+        idx = parent;
+    }
+    aeTimeEventHeapSet(eventLoop, idx, te);
+}
+
+static void aeTimeEventSiftDown(aeEventLoop *eventLoop, int idx) {
+    aeTimeEvent **heap = eventLoop->timeEventHeap;
+    aeTimeEvent *te = heap[idx];
+    int count = eventLoop->timeEventCount;
+
+    while (1) {
+        int child = idx*2+1;
+        if (child >= count) break;
+        if (child+1 < count && aeTimeEventBefore(heap[child+1], heap[child]))
+            child++;
+        if (!aeTimeEventBefore(heap[child], te)) break;
+        aeTimeEventHeapSet(eventLoop, idx, heap[child]);
+        idx = child;
+    }
+    aeTimeEventHeapSet(eventLoop, idx, te);
+}
+
+static void aeTimeEventHeapPush(aeEventLoop *eventLoop, aeTimeEvent *te) {
+    int idx = eventLoop->timeEventCount++;
+    aeTimeEventHeapSet(eventLoop, idx, te);
+    aeTimeEventSiftUp(eventLoop, idx);
+}
+
+static void aeTimeEventHeapRemove(aeEventLoop *eventLoop, aeTimeEvent *te) {
+    int idx = te->heapIndex;
+    int last = --eventLoop->timeEventCount;
+
+    te->heapIndex = -1;
+    if (idx == last) return;
+    aeTimeEventHeapSet(eventLoop, idx, eventLoop->timeEventHeap[last]);
+    if (idx > 0 && aeTimeEventBefore(eventLoop->timeEventHeap[idx],
+                eventLoop->timeEventHeap[(idx-1)/2]))
+        aeTimeEventSiftUp(eventLoop, idx);
+    else
+        aeTimeEventSiftDown(eventLoop, idx);
+}
+
+/* Grow the heap, the slot table and the fired scratch array together, so
+ * that the heap can never hold more events than there are slots. */
+static int aeTimeEventReserve(aeEventLoop *eventLoop) {
+    int j, size;
+
+    if (eventLoop->timeEventFreeCount) return AE_OK;
+    if (eventLoop->timeEventSize == AE_TIME_EVENT_MAX_SLOTS) return AE_ERR;
+    size = eventLoop->timeEventSize ? eventLoop->timeEventSize*2 : 16;
+    if (size > AE_TIME_EVENT_MAX_SLOTS) size = AE_TIME_EVENT_MAX_SLOTS;
+    eventLoop->timeEventHeap = zrealloc(eventLoop->timeEventHeap,sizeof(aeTimeEvent*)*size);
+    eventLoop->timeEventTable = zrealloc(eventLoop->timeEventTable,sizeof(aeTimeEvent*)*size);
+    eventLoop->timeEventFreeSlots = zrealloc(eventLoop->timeEventFreeSlots,sizeof(int)*size);
+    eventLoop->timeEventFired = zrealloc(eventLoop->timeEventFired,sizeof(aeTimeEvent*)*size);
+    /* Push new slots in reverse order so that lower slots are used first. */
+    for (j = size-1; j >= eventLoop->timeEventSize; j--) {
+        eventLoop->timeEventTable[j] = NULL;
+        eventLoop->timeEventFreeSlots[eventLoop->timeEventFreeCount++] = j;
+    }
+    eventLoop->timeEventSize = size;
+    return AE_OK;
+}
+
 long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
         aeTimeProc *proc, void *clientData,
         aeEventFinalizerProc *finalizerProc)
 {
-    long long id = eventLoop->timeEventNextId++;
+    long long id;
+    int slot;
     aeTimeEvent *te;
 
+    if (aeTimeEventReserve(eventLoop) == AE_ERR) return AE_ERR;
     te = zmalloc(sizeof(*te));
     if (te == NULL) return AE_ERR;
+    slot = eventLoop->timeEventFreeSlots[--eventLoop->timeEventFreeCount];
+    id = (eventLoop->timeEventNextId++ << AE_TIME_EVENT_SLOT_BITS) | slot;
     te->id = id;
     aeAddMillisecondsToNow(milliseconds,&te->when_sec,&te->when_ms);
     te->timeProc = proc;
     te->finalizerProc = finalizerProc;
     te->clientData = clientData;
-    te->next = eventLoop->timeEventHead;
-    eventLoop->timeEventHead = te;
+    te->next = NULL;
+    eventLoop->timeEventTable[slot] = te;
+    aeTimeEventHeapPush(eventLoop, te);
     return id;
 }
 
+/* Unlink the event from the heap and the slot table right away, but defer
+ * the finalizer to processTimeEvents(): the event may be deleted from its
+ * own callback, or from the callback of another event fired in the same
+ * iteration. */
+static void aeUnlinkTimeEvent(aeEventLoop *eventLoop, aeTimeEvent *te) {
+    int slot = (int) (te->id & AE_TIME_EVENT_SLOT_MASK);
+
+    if (te->heapIndex != -1) aeTimeEventHeapRemove(eventLoop, te);
+    eventLoop->timeEventTable[slot] = NULL;
+    eventLoop->timeEventFreeSlots[eventLoop->timeEventFreeCount++] = slot;
+    te->id = AE_DELETED_EVENT_ID;
+    te->next = eventLoop->timeEventDeleted;
+    eventLoop->timeEventDeleted = te;
+}
+
 int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id)
 {
-    aeTimeEvent *te = eventLoop->timeEventHead;
-    while(te) {
-        if (te->id == id) {
-            te->id = AE_DELETED_EVENT_ID;
-            return AE_OK;
-        }
-        te = te->next;
+    long long slot = id & AE_TIME_EVENT_SLOT_MASK;
+    aeTimeEvent *te;
+
+    if (id < 0 || slot >= eventLoop->timeEventSize) return AE_ERR;
+    te = eventLoop->timeEventTable[slot];
+    if (te == NULL || te->id != id)
+        return AE_ERR; /* NO event with the specified ID found */
+    aeUnlinkTimeEvent(eventLoop, te);
+    return AE_OK;
+}
+
+static void aeFreeDeletedTimeEvents(aeEventLoop *eventLoop) {
+    aeTimeEvent *te = eventLoop->timeEventDeleted, *next;
+
+    eventLoop->timeEventDeleted = NULL;
+    while (te) {
+        next = te->next;
+        if (te->finalizerProc)
+            te->finalizerProc(eventLoop, te->clientData);
+        zfree(te);
+        te = next;
     }
-    return AE_ERR; /* NO event with the specified ID found */
 }
 
 /* Search the first timer to fire.
@@ -249,32 +494,17 @@ int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id)
  * put in sleep without to delay any event.
  * If there are no timers NULL is returned.
  *
- * Note that's O(N) since time events are unsorted.
- * Possible optimizations (not needed by Redis so far, but...):
- * 1) Insert the event in order, so that the nearest is just the head.
- *    Much better but still insertion or deletion of timers is O(N).
- * 2) Use a skiplist to have this operation as O(1) and insertion as O(log(N)).
- */
+ * This is O(1) since the nearest timer is the root of the heap. */
 static aeTimeEvent *aeSearchNearestTimer(aeEventLoop *eventLoop)
 {
-    aeTimeEvent *te = eventLoop->timeEventHead;
-    aeTimeEvent *nearest = NULL;
-
-    while(te) {
-        if (!nearest || te->when_sec < nearest->when_sec ||
-                (te->when_sec == nearest->when_sec &&
-                 te->when_ms < nearest->when_ms))
-            nearest = te;
-        te = te->next;
-    }
-    return nearest;
+    return eventLoop->timeEventCount ? eventLoop->timeEventHeap[0] : NULL;
 }
 
 /* Process time events */
 static int processTimeEvents(aeEventLoop *eventLoop) {
-    int processed = 0;
-    aeTimeEvent *te, *prev;
-    long long maxId;
+    int processed = 0, fired = 0, j;
+    aeTimeEvent *te;
+    long now_sec, now_ms;
     time_t now = time(NULL);
 
     /* If the system clock is moved to the future, and then set back to the
@@ -284,64 +514,50 @@ static int processTimeEvents(aeEventLoop *eventLoop) {
      * Here we try to detect system clock skews, and force all the time
      * events to be processed ASAP when this happens: the idea is that
      * processing events earlier is less dangerous than delaying them
-     * indefinitely, and practice suggests it is. */
+     * indefinitely, and practice suggests it is. Since every event gets the
+     * same expire time the heap property is preserved. */
     if (now < eventLoop->lastTime) {
-        te = eventLoop->timeEventHead;
-        while(te) {
-            te->when_sec = 0;
-            te = te->next;
+        for (j = 0; j < eventLoop->timeEventCount; j++) {
+            eventLoop->timeEventHeap[j]->when_sec = 0;
+            eventLoop->timeEventHeap[j]->when_ms = 0;
         }
     }
     eventLoop->lastTime = now;
 
-    prev = NULL;
-    te = eventLoop->timeEventHead;
-    maxId = eventLoop->timeEventNextId-1;
-    while(te) {
-        long now_sec, now_ms;
-        long long id;
-
-        /* Remove events scheduled for deletion. */
-        if (te->id == AE_DELETED_EVENT_ID) {
-            aeTimeEvent *next = te->next;
-            if (prev == NULL)
-                eventLoop->timeEventHead = te->next;
-            else
-                prev->next = te->next;
-            if (te->finalizerProc)
-                te->finalizerProc(eventLoop, te->clientData);
-            zfree(te);
-            te = next;
-            continue;
-        }
+    /* Pop every due event first and only then run the callbacks: this way
+     * we don't process time events created or rescheduled by time events
+     * in this iteration, which would otherwise loop forever on a timer
+     * that keeps returning zero. */
+    aeGetTime(&now_sec, &now_ms);
+    while (eventLoop->timeEventCount) {
+        te = eventLoop->timeEventHeap[0];
+        if (now_sec < te->when_sec ||
+            (now_sec == te->when_sec && now_ms < te->when_ms))
+            break;
+        aeTimeEventHeapRemove(eventLoop, te);
+        eventLoop->timeEventFired[fired++] = te;
+    }
 
-        /* Make sure we don't process time events created by time events in
-         * this iteration. Note that this check is currently useless: we always
-         * add new timers on the head, however if we change the implementation
-         * detail, this check may be useful again: we keep it here for future
-         * defense. */
-        if (te->id > maxId) {
-            te = te->next;
-            continue;
-        }
-        aeGetTime(&now_sec, &now_ms);
-        if (now_sec > te->when_sec ||
-            (now_sec == te->when_sec && now_ms >= te->when_ms))
-        {
-            int retval;
-
-            id = te->id;
-            retval = te->timeProc(eventLoop, id, te->clientData);
-            processed++;
-            if (retval != AE_NOMORE) {
-                aeAddMillisecondsToNow(retval,&te->when_sec,&te->when_ms);
-            } else {
-                te->id = AE_DELETED_EVENT_ID;
-            }
+    for (j = 0; j < fired; j++) {
+        int retval;
+
+        te = eventLoop->timeEventFired[j];
+        /* Skip events deleted by a callback fired before this one. */
+        if (te->id == AE_DELETED_EVENT_ID) continue;
+        retval = te->timeProc(eventLoop, te->id, te->clientData);
+        processed++;
+        /* The callback may have deleted its own event. */
+        if (te->id == AE_DELETED_EVENT_ID) continue;
+        if (retval != AE_NOMORE) {
+            aeAddMillisecondsToNow(retval,&te->when_sec,&te->when_ms);
+            aeTimeEventHeapPush(eventLoop, te);
+        } else {
+            aeUnlinkTimeEvent(eventLoop, te);
         }
-        prev = te;
-        te = te->next;
     }
+
+    /* Remove events scheduled for deletion. */
+    aeFreeDeletedTimeEvents(eventLoop);
     return processed;
 }
 
@@ -468,6 +684,105 @@ void aeMain(aeEventLoop *eventLoop) {
     }
 }
 
+/* Backends that only implement readiness notification don't define
+ * AE_API_COMPLETION: completion based I/O is simply not available. */
+#ifndef AE_API_COMPLETION
+static int aeApiEnableCompletion(aeEventLoop *eventLoop) {
+    AE_NOTUSED(eventLoop);
+    errno = ENOTSUP;
+    return -1;
+}
+
+static int aeApiCreateAccept(aeEventLoop *eventLoop, int fd, aeAcceptProc *proc, void *clientData) {
+    AE_NOTUSED(eventLoop); AE_NOTUSED(fd); AE_NOTUSED(proc); AE_NOTUSED(clientData);
+    errno = ENOTSUP;
+    return -1;
+}
+
+static int aeApiCreateRecv(aeEventLoop *eventLoop, int fd, aeRecvProc *proc, void *clientData) {
+    AE_NOTUSED(eventLoop); AE_NOTUSED(fd); AE_NOTUSED(proc); AE_NOTUSED(clientData);
+    errno = ENOTSUP;
+    return -1;
+}
+
+static void aeApiDeleteRecv(aeEventLoop *eventLoop, int fd) {
+    AE_NOTUSED(eventLoop); AE_NOTUSED(fd);
+}
+
+static int aeApiSendv(aeEventLoop *eventLoop, int fd, const struct iovec *iov, int iovcnt,
+        aeSendProc *proc, void *clientData) {
+    AE_NOTUSED(eventLoop); AE_NOTUSED(fd); AE_NOTUSED(iov); AE_NOTUSED(iovcnt);
+    AE_NOTUSED(proc); AE_NOTUSED(clientData);
+    errno = ENOTSUP;
+    return -1;
+}
+
+static void aeApiDeleteCompletion(aeEventLoop *eventLoop, int fd,
+        aeEventFinalizerProc *finalizerProc, void *clientData) {
+    AE_NOTUSED(fd);
+    if (finalizerProc) finalizerProc(eventLoop, clientData);
+}
+#endif
+
+int aeEnableCompletionEvents(aeEventLoop *eventLoop) {
+    return aeApiEnableCompletion(eventLoop) == -1 ? AE_ERR : AE_OK;
+}
+
+/* Accept connections on the listening socket fd until the event is deleted,
+ * proc gets called with every accepted socket. */
+int aeCreateAcceptEvent(aeEventLoop *eventLoop, int fd, aeAcceptProc *proc, void *clientData) {
+    if (fd >= eventLoop->setsize) {
+        errno = ERANGE;
+        return AE_ERR;
+    }
+    return aeApiCreateAccept(eventLoop, fd, proc, clientData) == -1 ? AE_ERR : AE_OK;
+}
+
+/* Receive from fd until the event is deleted. proc gets called with the data
+ * received, which is only valid until proc returns, with zero at end of
+ * file and with -1 (errno set) on errors. */
+int aeCreateRecvEvent(aeEventLoop *eventLoop, int fd, aeRecvProc *proc, void *clientData) {
+    if (fd >= eventLoop->setsize) {
+        errno = ERANGE;
+        return AE_ERR;
+    }
+    return aeApiCreateRecv(eventLoop, fd, proc, clientData) == -1 ? AE_ERR : AE_OK;
+}
+
+/* Stop receiving from fd until aeCreateRecvEvent() is called again. What
+ * the kernel already received may still be passed to proc until the
+ * request is cancelled, data is never dropped. */
+void aeDeleteRecvEvent(aeEventLoop *eventLoop, int fd) {
+    if (fd >= eventLoop->setsize) return;
+    aeApiDeleteRecv(eventLoop, fd);
+}
+
+/* Queue a gathering send of up to AE_SEND_IOV_MAX buffers, submitted with
+ * the next poll. The iovec array is copied, the buffers it points to must
+ * stay valid until proc is called with the number of bytes written or -1.
+ * Only one send per fd can be in flight. */
+int aeSendv(aeEventLoop *eventLoop, int fd, const struct iovec *iov, int iovcnt,
+        aeSendProc *proc, void *clientData) {
+    if (fd >= eventLoop->setsize || iovcnt > AE_SEND_IOV_MAX) {
+        errno = ERANGE;
+        return AE_ERR;
+    }
+    return aeApiSendv(eventLoop, fd, iov, iovcnt, proc, clientData) == -1 ? AE_ERR : AE_OK;
+}
+
+/* Cancel every completion event of fd. No proc is called for fd anymore,
+ * but the kernel may still reference buffers of in flight requests:
+ * finalizerProc is called, possibly right away, once all of them are gone
+ * and it's safe to close fd and release the buffers. */
+void aeDeleteCompletionEvents(aeEventLoop *eventLoop, int fd,
+        aeEventFinalizerProc *finalizerProc, void *clientData) {
+    if (fd >= eventLoop->setsize) {
+        if (finalizerProc) finalizerProc(eventLoop, clientData);
+        return;
+    }
+    aeApiDeleteCompletion(eventLoop, fd, finalizerProc, clientData);
+}
+
 char *aeGetApiName(void) {
     return aeApiName();
 }
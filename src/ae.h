@@ -51,6 +51,9 @@ extern "C" {
 #define AE_ALL_EVENTS (AE_FILE_EVENTS|AE_TIME_EVENTS)
 #define AE_DONT_WAIT 4
 
+/* Max number of buffers gathered by a single aeSendv() */
+#define AE_SEND_IOV_MAX 16
+
 #define AE_NOMORE -1
 #define AE_DELETED_EVENT_ID -1
 
@@ -58,12 +61,17 @@ extern "C" {
 #define AE_NOTUSED(V) ((void) V)
 
 struct aeEventLoop;
+struct iovec;
 
 /* Types and data structures */
 typedef void aeFileProc(struct aeEventLoop *eventLoop, int fd, void *clientData, int mask);
 typedef int aeTimeProc(struct aeEventLoop *eventLoop, long long id, void *clientData);
 typedef void aeEventFinalizerProc(struct aeEventLoop *eventLoop, void *clientData);
 typedef void aeBeforeSleepProc(struct aeEventLoop *eventLoop);
+typedef void aeAcceptProc(struct aeEventLoop *eventLoop, int fd, void *clientData, int cfd);
+typedef void aeRecvProc(struct aeEventLoop *eventLoop, int fd, void *clientData, const char *buf, long nread);
+typedef void aeSendProc(struct aeEventLoop *eventLoop, int fd, void *clientData, long nwritten);
+typedef void aePostProc(struct aeEventLoop *eventLoop, void *clientData);
 
 /* File event structure */
 typedef struct aeFileEvent {
@@ -81,9 +89,17 @@ typedef struct aeTimeEvent {
     aeTimeProc *timeProc;
     aeEventFinalizerProc *finalizerProc;
     void *clientData;
-    struct aeTimeEvent *next;
+    int heapIndex; /* position in the timer heap, -1 while not queued */
+    struct aeTimeEvent *next; /* only used to chain deleted events */
 } aeTimeEvent;
 
+/* Task posted from another thread */
+typedef struct aePostedTask {
+    aePostProc *proc;
+    void *clientData;
+    struct aePostedTask *next;
+} aePostedTask;
+
 /* A fired event */
 typedef struct aeFiredEvent {
     int fd;
@@ -98,8 +114,17 @@ typedef struct aeEventLoop {
     time_t lastTime;     /* Used to detect system clock skew */
     aeFileEvent *events; /* Registered events */
     aeFiredEvent *fired; /* Fired events */
-    aeTimeEvent *timeEventHead;
+    aeTimeEvent **timeEventHeap; /* Binary min-heap ordered by expire time */
+    int timeEventCount;          /* Number of queued time events */
+    int timeEventSize;           /* Allocated slots in heap and table */
+    aeTimeEvent **timeEventTable; /* Slot table to resolve ids in O(1) */
+    int *timeEventFreeSlots;     /* Stack of unused slots in the table */
+    int timeEventFreeCount;
+    aeTimeEvent **timeEventFired; /* Scratch array for due time events */
+    aeTimeEvent *timeEventDeleted; /* Deleted events pending finalization */
     int stop;
+    aePostedTask *postHead; /* Lock free stack of tasks posted to the loop */
+    int postFd[2];          /* Wakes up the loop when posting to an empty stack */
     void *apidata; /* This is used for polling API specific data */
     aeBeforeSleepProc *beforesleep;
     void *data;
@@ -125,6 +150,21 @@ void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep
 int aeGetSetSize(aeEventLoop *eventLoop);
 int aeResizeSetSize(aeEventLoop *eventLoop, int setsize);
 
+/* Run proc(eventLoop, clientData) from the thread of the event loop. This is
+ * the only function that can be called from any thread. */
+void aePost(aeEventLoop *eventLoop, aePostProc *proc, void *clientData);
+
+/* Completion based I/O, only supported by the io_uring backend: every other
+ * backend returns AE_ERR from aeEnableCompletionEvents(). */
+int aeEnableCompletionEvents(aeEventLoop *eventLoop);
+int aeCreateAcceptEvent(aeEventLoop *eventLoop, int fd, aeAcceptProc *proc, void *clientData);
+int aeCreateRecvEvent(aeEventLoop *eventLoop, int fd, aeRecvProc *proc, void *clientData);
+void aeDeleteRecvEvent(aeEventLoop *eventLoop, int fd);
+int aeSendv(aeEventLoop *eventLoop, int fd, const struct iovec *iov, int iovcnt,
+        aeSendProc *proc, void *clientData);
+void aeDeleteCompletionEvents(aeEventLoop *eventLoop, int fd,
+        aeEventFinalizerProc *finalizerProc, void *clientData);
+
 #ifdef __cplusplus
 }
 #endif
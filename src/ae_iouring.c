@@ -0,0 +1,735 @@
+/* Linux io_uring(7) based ae.c module
+ *
+ * Readiness is emulated with one-shot IORING_OP_POLL_ADD requests, one per
+ * fd and direction, so the semantic stays level triggered like the other
+ * backends. Interest changes only queue SQEs: they are flushed together with
+ * the wait in a single io_uring_enter(2) call from aeApiPoll(), instead of
+ * costing one epoll_ctl(2) each.
+ *
+ * The backend also implements completion based I/O (AE_API_COMPLETION):
+ * multishot accept, multishot recv into a ring of provided buffers shared by
+ * every connection of the loop, and gathering sends. Those need kernel 6.0.
+ *
+ * The ring is driven through the raw system calls so that no liburing is
+ * required. Kernel 5.11 or newer is needed (IORING_FEAT_EXT_ARG).
+ */
+
+
+#include <poll.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#define AE_API_COMPLETION 1
+
+/* Layout of the 64 bit user_data attached to every SQE:
+ * bits 56..63 operation, bits 32..55 generation, bits 0..31 fd.
+ * The generation is bumped every time a poll is removed, so completions
+ * that were already in flight for a removed poll are recognized as stale. */
+#define AE_URING_OP_IGNORE 0
+#define AE_URING_OP_POLL_IN 1
+#define AE_URING_OP_POLL_OUT 2
+#define AE_URING_OP_ACCEPT 3
+#define AE_URING_OP_RECV 4
+#define AE_URING_OP_SEND 5
+
+#define AE_URING_GEN_MASK 0xffffff
+#define AE_URING_DATA(op,gen,fd) \
+    (((uint64_t)(op)<<56) | (((uint64_t)(gen)&AE_URING_GEN_MASK)<<32) | (uint32_t)(fd))
+#define AE_URING_DATA_OP(d) ((int)((d)>>56))
+#define AE_URING_DATA_GEN(d) ((uint32_t)(((d)>>32)&AE_URING_GEN_MASK))
+#define AE_URING_DATA_FD(d) ((int)(uint32_t)(d))
+
+#define AE_URING_MAX_SQ_ENTRIES 4096
+#define AE_URING_MAX_CQ_ENTRIES 65536
+
+/* Provided buffers multishot recv picks from, shared by every fd */
+#define AE_URING_RECV_BUFFERS 1024
+#define AE_URING_RECV_BUFFER_SIZE (8*1024)
+#define AE_URING_RECV_GROUP 0
+
+/* Completion event flags */
+#define AE_URING_ACCEPT 1   /* multishot accept registered */
+#define AE_URING_RECV 2     /* multishot recv registered */
+#define AE_URING_SEND 4     /* send in flight */
+#define AE_URING_DELETED 8  /* waiting for in flight requests to drain */
+#define AE_URING_RECV_ARMED 16   /* multishot recv in the kernel */
+#define AE_URING_RECV_STOPPED 32 /* recv cancelled, not armed again */
+
+typedef struct aeUringCompletion {
+    int flags;
+    int inflight; /* requests the kernel still owns */
+    uint32_t recvGen; /* tells the armed recv apart when cancelling it */
+    aeAcceptProc *acceptProc;
+    aeRecvProc *recvProc;
+    void *clientData;
+    aeSendProc *sendProc;
+    void *sendData;
+    aeEventFinalizerProc *finalizerProc;
+    void *finalizerData;
+    struct msghdr msg;
+    struct iovec iov[AE_SEND_IOV_MAX];
+} aeUringCompletion;
+
+typedef struct aeApiState {
+    int ringfd;
+    /* Submission queue */
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned sqMask;
+    unsigned sqEntries;
+    unsigned *sqArray;
+    struct io_uring_sqe *sqes;
+    unsigned toSubmit; /* SQEs queued since the last io_uring_enter() */
+    /* Completion queue */
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe *cqes;
+    /* Mappings */
+    void *sqRing;
+    size_t sqRingSize;
+    void *cqRing;
+    size_t cqRingSize;
+    size_t sqesSize;
+    /* Per fd state, indexed by fd */
+    unsigned char *armed; /* AE_READABLE|AE_WRITABLE polls in the kernel */
+    unsigned char *rearm; /* fd is queued in the rearm array */
+    uint32_t *gen;        /* generations, two per fd (read and write) */
+    int *rearmFds;        /* fds whose one-shot poll fired */
+    int rearmCount;
+    /* Completion based I/O */
+    aeUringCompletion **completions; /* indexed by fd, allocated on demand */
+    struct io_uring_buf_ring *bufRing;
+    size_t bufRingSize;
+    char *bufs;
+    unsigned short bufTail;
+} aeApiState;
+
+static int aeUringSetup(unsigned entries, struct io_uring_params *p) {
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int aeUringEnter(int fd, unsigned toSubmit, unsigned minComplete,
+        unsigned flags, void *arg, size_t argsz) {
+    return (int) syscall(__NR_io_uring_enter, fd, toSubmit, minComplete,
+            flags, arg, argsz);
+}
+
+static unsigned aeUringRoundUp(unsigned v) {
+    unsigned r = 1;
+    while (r < v) r <<= 1;
+    return r;
+}
+
+/* Hand every queued SQE to the kernel. Only needed when the submission
+ * queue is full, aeApiPoll() submits everything else together with the
+ * wait. */
+static int aeUringFlush(aeApiState *state) {
+    while (state->toSubmit) {
+        int rc = aeUringEnter(state->ringfd, state->toSubmit, 0, 0, NULL, 0);
+        if (rc < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        state->toSubmit -= rc;
+    }
+    return 0;
+}
+
+static struct io_uring_sqe *aeUringGetSqe(aeApiState *state) {
+    unsigned head, tail = *state->sqTail;
+    struct io_uring_sqe *sqe;
+
+    head = __atomic_load_n(state->sqHead, __ATOMIC_ACQUIRE);
+    if (tail - head >= state->sqEntries) {
+        if (aeUringFlush(state) == -1) return NULL;
+        head = __atomic_load_n(state->sqHead, __ATOMIC_ACQUIRE);
+        if (tail - head >= state->sqEntries) return NULL;
+    }
+    sqe = &state->sqes[tail & state->sqMask];
+    memset(sqe, 0, sizeof(*sqe));
+    state->sqArray[tail & state->sqMask] = tail & state->sqMask;
+    __atomic_store_n(state->sqTail, tail + 1, __ATOMIC_RELEASE);
+    state->toSubmit++;
+    return sqe;
+}
+
+static int aeUringPollAdd(aeApiState *state, int fd, int dir) {
+    struct io_uring_sqe *sqe = aeUringGetSqe(state);
+    int idx = fd*2 + (dir == AE_WRITABLE);
+
+    if (sqe == NULL) return -1;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = dir == AE_READABLE ? POLLIN : POLLOUT;
+    sqe->user_data = AE_URING_DATA(dir == AE_READABLE ?
+            AE_URING_OP_POLL_IN : AE_URING_OP_POLL_OUT, state->gen[idx], fd);
+    state->armed[fd] |= dir;
+    return 0;
+}
+
+static void aeUringPollRemove(aeApiState *state, int fd, int dir) {
+    struct io_uring_sqe *sqe;
+    int idx = fd*2 + (dir == AE_WRITABLE);
+
+    if (state->armed[fd] & dir) {
+        if ((sqe = aeUringGetSqe(state)) != NULL) {
+            sqe->opcode = IORING_OP_POLL_REMOVE;
+            sqe->fd = -1;
+            sqe->addr = AE_URING_DATA(dir == AE_READABLE ?
+                    AE_URING_OP_POLL_IN : AE_URING_OP_POLL_OUT, state->gen[idx], fd);
+            sqe->user_data = AE_URING_DATA(AE_URING_OP_IGNORE, 0, fd);
+        }
+        state->armed[fd] &= ~dir;
+    }
+    /* Whatever is still in flight for this direction is stale now. The
+     * generation wraps within the bits user_data has room for, so that it
+     * keeps matching what the completions carry. */
+    state->gen[idx] = (state->gen[idx] + 1) & AE_URING_GEN_MASK;
+}
+
+static int aeApiResize(aeEventLoop *eventLoop, int setsize) {
+    aeApiState *state = eventLoop->apidata;
+    int oldsize = eventLoop->setsize, j, k;
+
+    /* Completion events are not accounted in maxfd. */
+    for (j = setsize; j < oldsize; j++) {
+        if (state->completions[j] && (state->completions[j]->flags ||
+                    state->completions[j]->inflight))
+            return -1;
+    }
+    for (j = setsize; j < oldsize; j++) zfree(state->completions[j]);
+    /* Fds past the new size have no events left to arm. */
+    for (j = 0, k = 0; j < state->rearmCount; j++) {
+        if (state->rearmFds[j] < setsize) state->rearmFds[k++] = state->rearmFds[j];
+    }
+    state->rearmCount = k;
+    state->completions = zrealloc(state->completions, sizeof(aeUringCompletion*)*setsize);
+    state->armed = zrealloc(state->armed, setsize);
+    state->rearm = zrealloc(state->rearm, setsize);
+    state->gen = zrealloc(state->gen, sizeof(uint32_t)*setsize*2);
+    state->rearmFds = zrealloc(state->rearmFds, sizeof(int)*setsize);
+    for (j = oldsize; j < setsize; j++) {
+        state->armed[j] = AE_NONE;
+        state->rearm[j] = 0;
+        state->gen[j*2] = state->gen[j*2+1] = 0;
+        state->completions[j] = NULL;
+    }
+    return 0;
+}
+
+static int aeApiPoll(aeEventLoop *eventLoop, struct timeval *tvp);
+
+/* Wait, for a second at most, until the kernel dropped the requests of the
+ * deleted fds: their finalizers release what the requests referenced. */
+static void aeUringDrain(aeEventLoop *eventLoop) {
+    aeApiState *state = eventLoop->apidata;
+    struct timeval tv;
+    int j, pending, tries = 100;
+
+    do {
+        pending = 0;
+        for (j = 0; j < eventLoop->setsize && !pending; j++) {
+            aeUringCompletion *c = state->completions[j];
+            if (c && (c->flags & AE_URING_DELETED) && c->inflight) pending = 1;
+        }
+        if (pending) {
+            tv.tv_sec = 0;
+            tv.tv_usec = 10000;
+            aeApiPoll(eventLoop, &tv);
+        }
+    } while (pending && --tries);
+}
+
+static void aeApiFree(aeEventLoop *eventLoop) {
+    aeApiState *state = eventLoop->apidata;
+    int j;
+
+    if (state == NULL) return;
+    if (state->completions) {
+        aeUringDrain(eventLoop);
+        for (j = 0; j < eventLoop->setsize; j++) zfree(state->completions[j]);
+        zfree(state->completions);
+    }
+    if (state->bufRing) munmap(state->bufRing, state->bufRingSize);
+    zfree(state->bufs);
+    if (state->sqes && state->sqes != MAP_FAILED)
+        munmap(state->sqes, state->sqesSize);
+    if (state->cqRing && state->cqRing != MAP_FAILED &&
+            state->cqRing != state->sqRing)
+        munmap(state->cqRing, state->cqRingSize);
+    if (state->sqRing && state->sqRing != MAP_FAILED)
+        munmap(state->sqRing, state->sqRingSize);
+    if (state->ringfd != -1) close(state->ringfd);
+    zfree(state->armed);
+    zfree(state->rearm);
+    zfree(state->gen);
+    zfree(state->rearmFds);
+    zfree(state);
+    eventLoop->apidata = NULL;
+}
+
+static int aeApiCreate(aeEventLoop *eventLoop) {
+    aeApiState *state = zcalloc(sizeof(aeApiState));
+    struct io_uring_params p;
+    unsigned entries, cqEntries;
+    int j;
+
+    if (!state) return -1;
+    state->ringfd = -1;
+    eventLoop->apidata = state;
+
+    entries = aeUringRoundUp(eventLoop->setsize);
+    if (entries < 64) entries = 64;
+    if (entries > AE_URING_MAX_SQ_ENTRIES) entries = AE_URING_MAX_SQ_ENTRIES;
+    /* Every fd may have a poll in flight for both directions. */
+    cqEntries = aeUringRoundUp(eventLoop->setsize*2);
+    if (cqEntries < entries*2) cqEntries = entries*2;
+    if (cqEntries > AE_URING_MAX_CQ_ENTRIES) cqEntries = AE_URING_MAX_CQ_ENTRIES;
+
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = cqEntries;
+    state->ringfd = aeUringSetup(entries, &p);
+    if (state->ringfd == -1) goto err;
+    if (!(p.features & IORING_FEAT_EXT_ARG)) {
+        errno = ENOSYS;
+        goto err;
+    }
+
+    state->sqRingSize = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+    state->cqRingSize = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (state->cqRingSize > state->sqRingSize)
+            state->sqRingSize = state->cqRingSize;
+        state->cqRingSize = state->sqRingSize;
+    }
+    state->sqRing = mmap(NULL, state->sqRingSize, PROT_READ|PROT_WRITE,
+            MAP_SHARED|MAP_POPULATE, state->ringfd, IORING_OFF_SQ_RING);
+    if (state->sqRing == MAP_FAILED) goto err;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        state->cqRing = state->sqRing;
+    } else {
+        state->cqRing = mmap(NULL, state->cqRingSize, PROT_READ|PROT_WRITE,
+                MAP_SHARED|MAP_POPULATE, state->ringfd, IORING_OFF_CQ_RING);
+        if (state->cqRing == MAP_FAILED) goto err;
+    }
+    state->sqesSize = p.sq_entries*sizeof(struct io_uring_sqe);
+    state->sqes = mmap(NULL, state->sqesSize, PROT_READ|PROT_WRITE,
+            MAP_SHARED|MAP_POPULATE, state->ringfd, IORING_OFF_SQES);
+    if (state->sqes == MAP_FAILED) goto err;
+
+    state->sqHead = (unsigned *) ((char *) state->sqRing + p.sq_off.head);
+    state->sqTail = (unsigned *) ((char *) state->sqRing + p.sq_off.tail);
+    state->sqMask = *(unsigned *) ((char *) state->sqRing + p.sq_off.ring_mask);
+    state->sqEntries = p.sq_entries;
+    state->sqArray = (unsigned *) ((char *) state->sqRing + p.sq_off.array);
+    state->cqHead = (unsigned *) ((char *) state->cqRing + p.cq_off.head);
+    state->cqTail = (unsigned *) ((char *) state->cqRing + p.cq_off.tail);
+    state->cqMask = *(unsigned *) ((char *) state->cqRing + p.cq_off.ring_mask);
+    state->cqes = (struct io_uring_cqe *) ((char *) state->cqRing + p.cq_off.cqes);
+
+    state->armed = zmalloc(eventLoop->setsize);
+    state->rearm = zmalloc(eventLoop->setsize);
+    state->gen = zmalloc(sizeof(uint32_t)*eventLoop->setsize*2);
+    state->rearmFds = zmalloc(sizeof(int)*eventLoop->setsize);
+    state->completions = zmalloc(sizeof(aeUringCompletion*)*eventLoop->setsize);
+    for (j = 0; j < eventLoop->setsize; j++) {
+        state->armed[j] = AE_NONE;
+        state->rearm[j] = 0;
+        state->gen[j*2] = state->gen[j*2+1] = 0;
+        state->completions[j] = NULL;
+    }
+    return 0;
+
+err:
+    aeApiFree(eventLoop);
+    return -1;
+}
+
+static int aeApiAddEvent(aeEventLoop *eventLoop, int fd, int mask) {
+    aeApiState *state = eventLoop->apidata;
+
+    mask &= ~state->armed[fd];
+    if ((mask & AE_READABLE) && aeUringPollAdd(state, fd, AE_READABLE) == -1)
+        return -1;
+    if ((mask & AE_WRITABLE) && aeUringPollAdd(state, fd, AE_WRITABLE) == -1)
+        return -1;
+    return 0;
+}
+
+static void aeApiDelEvent(aeEventLoop *eventLoop, int fd, int delmask) {
+    aeApiState *state = eventLoop->apidata;
+
+    if (delmask & AE_READABLE) aeUringPollRemove(state, fd, AE_READABLE);
+    if (delmask & AE_WRITABLE) aeUringPollRemove(state, fd, AE_WRITABLE);
+}
+
+/* One-shot polls that fired are armed again right before the next wait,
+ * and only for directions the fd is still interested in, so a handler that
+ * removes its event does not cost a POLL_REMOVE. */
+static void aeUringRearm(aeEventLoop *eventLoop) {
+    aeApiState *state = eventLoop->apidata;
+    int j, kept = 0;
+
+    for (j = 0; j < state->rearmCount; j++) {
+        int fd = state->rearmFds[j];
+        int mask = eventLoop->events[fd].mask & ~state->armed[fd];
+
+        if (((mask & AE_READABLE) && aeUringPollAdd(state, fd, AE_READABLE) == -1) ||
+            ((mask & AE_WRITABLE) && aeUringPollAdd(state, fd, AE_WRITABLE) == -1)) {
+            /* No room to submit: keep the fd, the next iteration retries
+             * whatever direction is still not armed. */
+            state->rearmFds[kept++] = fd;
+            continue;
+        }
+        state->rearm[fd] = 0;
+    }
+    state->rearmCount = kept;
+}
+
+static int aeApiEnableCompletion(aeEventLoop *eventLoop) {
+    aeApiState *state = eventLoop->apidata;
+    struct io_uring_buf_reg reg;
+    unsigned j;
+
+    if (state->bufRing) return 0;
+    state->bufRingSize = sizeof(struct io_uring_buf)*AE_URING_RECV_BUFFERS;
+    state->bufRing = mmap(NULL, state->bufRingSize, PROT_READ|PROT_WRITE,
+            MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (state->bufRing == MAP_FAILED) {
+        state->bufRing = NULL;
+        return -1;
+    }
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t) (uintptr_t) state->bufRing;
+    reg.ring_entries = AE_URING_RECV_BUFFERS;
+    reg.bgid = AE_URING_RECV_GROUP;
+    if (syscall(__NR_io_uring_register, state->ringfd,
+                IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+        munmap(state->bufRing, state->bufRingSize);
+        state->bufRing = NULL;
+        return -1;
+    }
+    state->bufs = zmalloc((size_t) AE_URING_RECV_BUFFERS*AE_URING_RECV_BUFFER_SIZE);
+    state->bufTail = 0;
+    for (j = 0; j < AE_URING_RECV_BUFFERS; j++) {
+        struct io_uring_buf *buf = &state->bufRing->bufs[j];
+        buf->addr = (uint64_t) (uintptr_t) (state->bufs + (size_t) j*AE_URING_RECV_BUFFER_SIZE);
+        buf->len = AE_URING_RECV_BUFFER_SIZE;
+        buf->bid = j;
+    }
+    state->bufTail = AE_URING_RECV_BUFFERS;
+    __atomic_store_n(&state->bufRing->tail, state->bufTail, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Give a provided buffer back to the kernel once its data was consumed. */
+static void aeUringRecycleBuffer(aeApiState *state, unsigned bid) {
+    struct io_uring_buf *buf = &state->bufRing->bufs[state->bufTail & (AE_URING_RECV_BUFFERS-1)];
+
+    buf->addr = (uint64_t) (uintptr_t) (state->bufs + (size_t) bid*AE_URING_RECV_BUFFER_SIZE);
+    buf->len = AE_URING_RECV_BUFFER_SIZE;
+    buf->bid = bid;
+    state->bufTail++;
+    __atomic_store_n(&state->bufRing->tail, state->bufTail, __ATOMIC_RELEASE);
+}
+
+static aeUringCompletion *aeUringGetCompletion(aeApiState *state, int fd) {
+    aeUringCompletion *c = state->completions[fd];
+
+    if (c == NULL) c = state->completions[fd] = zcalloc(sizeof(aeUringCompletion));
+    return c;
+}
+
+static int aeUringArmAccept(aeApiState *state, int fd) {
+    struct io_uring_sqe *sqe = aeUringGetSqe(state);
+
+    if (sqe == NULL) return -1;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = AE_URING_DATA(AE_URING_OP_ACCEPT, 0, fd);
+    state->completions[fd]->inflight++;
+    return 0;
+}
+
+static int aeUringArmRecv(aeApiState *state, int fd) {
+    struct io_uring_sqe *sqe = aeUringGetSqe(state);
+    aeUringCompletion *c = state->completions[fd];
+
+    if (sqe == NULL) return -1;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = AE_URING_RECV_GROUP;
+    sqe->user_data = AE_URING_DATA(AE_URING_OP_RECV, ++c->recvGen, fd);
+    c->inflight++;
+    c->flags |= AE_URING_RECV_ARMED;
+    return 0;
+}
+
+static int aeApiCreateAccept(aeEventLoop *eventLoop, int fd, aeAcceptProc *proc, void *clientData) {
+    aeApiState *state = eventLoop->apidata;
+    aeUringCompletion *c = aeUringGetCompletion(state, fd);
+
+    if (c->flags & (AE_URING_ACCEPT|AE_URING_DELETED)) {
+        errno = EBUSY;
+        return -1;
+    }
+    c->acceptProc = proc;
+    c->clientData = clientData;
+    if (aeUringArmAccept(state, fd) == -1) return -1;
+    c->flags |= AE_URING_ACCEPT;
+    return 0;
+}
+
+static int aeApiCreateRecv(aeEventLoop *eventLoop, int fd, aeRecvProc *proc, void *clientData) {
+    aeApiState *state = eventLoop->apidata;
+    aeUringCompletion *c;
+
+    if (state->bufRing == NULL) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    c = aeUringGetCompletion(state, fd);
+    if ((c->flags & AE_URING_DELETED) ||
+        (c->flags & (AE_URING_RECV|AE_URING_RECV_STOPPED)) == AE_URING_RECV) {
+        errno = EBUSY;
+        return -1;
+    }
+    c->recvProc = proc;
+    c->clientData = clientData;
+    if (c->flags & AE_URING_RECV_STOPPED) {
+        /* Still armed: the cancel ends it and it gets armed again. */
+        c->flags &= ~AE_URING_RECV_STOPPED;
+        return 0;
+    }
+    if (aeUringArmRecv(state, fd) == -1) return -1;
+    c->flags |= AE_URING_RECV;
+    return 0;
+}
+
+static void aeApiDeleteRecv(aeEventLoop *eventLoop, int fd) {
+    aeApiState *state = eventLoop->apidata;
+    aeUringCompletion *c = state->completions[fd];
+    struct io_uring_sqe *sqe;
+
+    if (c == NULL || (c->flags & (AE_URING_RECV|AE_URING_RECV_STOPPED|AE_URING_DELETED)) != AE_URING_RECV)
+        return;
+    if (!(c->flags & AE_URING_RECV_ARMED)) {
+        c->flags &= ~AE_URING_RECV;
+        return;
+    }
+    /* Submitted right away rather than with the next wait, so that the
+     * kernel stops filling buffers for fd. What it completed before that
+     * still reaches the proc. */
+    c->flags |= AE_URING_RECV_STOPPED;
+    if ((sqe = aeUringGetSqe(state)) != NULL) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = AE_URING_DATA(AE_URING_OP_RECV, c->recvGen, fd);
+        sqe->user_data = AE_URING_DATA(AE_URING_OP_IGNORE, 0, fd);
+        aeUringFlush(state);
+    }
+}
+
+static int aeApiSendv(aeEventLoop *eventLoop, int fd, const struct iovec *iov, int iovcnt,
+        aeSendProc *proc, void *clientData) {
+    aeApiState *state = eventLoop->apidata;
+    aeUringCompletion *c = aeUringGetCompletion(state, fd);
+    struct io_uring_sqe *sqe;
+
+    if (c->flags & (AE_URING_SEND|AE_URING_DELETED)) {
+        errno = EBUSY;
+        return -1;
+    }
+    if ((sqe = aeUringGetSqe(state)) == NULL) return -1;
+    memcpy(c->iov, iov, sizeof(struct iovec)*iovcnt);
+    memset(&c->msg, 0, sizeof(c->msg));
+    c->msg.msg_iov = c->iov;
+    c->msg.msg_iovlen = iovcnt;
+    c->sendProc = proc;
+    c->sendData = clientData;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) &c->msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = AE_URING_DATA(AE_URING_OP_SEND, 0, fd);
+    c->inflight++;
+    c->flags |= AE_URING_SEND;
+    return 0;
+}
+
+static void aeApiDeleteCompletion(aeEventLoop *eventLoop, int fd,
+        aeEventFinalizerProc *finalizerProc, void *clientData) {
+    aeApiState *state = eventLoop->apidata;
+    aeUringCompletion *c = state->completions[fd];
+    struct io_uring_sqe *sqe;
+
+    if (c == NULL || c->inflight == 0) {
+        if (c) c->flags = 0;
+        if (finalizerProc) finalizerProc(eventLoop, clientData);
+        return;
+    }
+    c->flags = AE_URING_DELETED;
+    c->finalizerProc = finalizerProc;
+    c->finalizerData = clientData;
+    if ((sqe = aeUringGetSqe(state)) != NULL) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = fd;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_FD|IORING_ASYNC_CANCEL_ALL;
+        sqe->user_data = AE_URING_DATA(AE_URING_OP_IGNORE, 0, fd);
+    }
+}
+
+/* Dispatch the completion of an accept, recv or send request. Procs are
+ * not called anymore once the events of the fd were deleted, even from
+ * within a proc of the same fd. */
+static void aeUringComplete(aeEventLoop *eventLoop, int op, int fd, int res, unsigned flags) {
+    aeApiState *state = eventLoop->apidata;
+    aeUringCompletion *c = fd < eventLoop->setsize ? state->completions[fd] : NULL;
+    int more = flags & IORING_CQE_F_MORE;
+    char *buf = NULL;
+    unsigned bid = 0;
+
+    if (c == NULL) return;
+    if (!more) c->inflight--;
+    if (op == AE_URING_OP_RECV && (flags & IORING_CQE_F_BUFFER)) {
+        bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        buf = state->bufs + (size_t) bid*AE_URING_RECV_BUFFER_SIZE;
+    }
+
+    switch (op) {
+    case AE_URING_OP_ACCEPT:
+        if (res >= 0) {
+            if (c->flags & AE_URING_ACCEPT)
+                c->acceptProc(eventLoop, fd, c->clientData, res);
+            else
+                close(res);
+        }
+        if (!more && (c->flags & AE_URING_ACCEPT)) aeUringArmAccept(state, fd);
+        break;
+    case AE_URING_OP_RECV:
+        if (c->flags & AE_URING_RECV) {
+            if (res >= 0) {
+                c->recvProc(eventLoop, fd, c->clientData, buf, res);
+            } else if (res != -ENOBUFS && res != -ECANCELED) {
+                errno = -res;
+                c->recvProc(eventLoop, fd, c->clientData, NULL, -1);
+            }
+        }
+        if (buf) aeUringRecycleBuffer(state, bid);
+        if (more) break;
+        c->flags &= ~AE_URING_RECV_ARMED;
+        if (c->flags & AE_URING_RECV_STOPPED) {
+            c->flags &= ~(AE_URING_RECV|AE_URING_RECV_STOPPED);
+        } else if ((c->flags & AE_URING_RECV) && (res > 0 || res == -ENOBUFS || res == -ECANCELED)) {
+            /* The kernel stops a multishot recv when it runs out of
+             * buffers, they are all back in the ring now. A cancelled one
+             * was asked for again before the cancel went through. */
+            aeUringArmRecv(state, fd);
+        }
+        break;
+    case AE_URING_OP_SEND:
+        if (c->flags & AE_URING_SEND) {
+            c->flags &= ~AE_URING_SEND;
+            if (res < 0) errno = -res;
+            c->sendProc(eventLoop, fd, c->sendData, res < 0 ? -1 : res);
+        }
+        break;
+    }
+
+    if ((c->flags & AE_URING_DELETED) && c->inflight == 0) {
+        aeEventFinalizerProc *finalizerProc = c->finalizerProc;
+
+        c->flags = 0;
+        c->finalizerProc = NULL;
+        if (finalizerProc) finalizerProc(eventLoop, c->finalizerData);
+    }
+}
+
+static int aeApiPoll(aeEventLoop *eventLoop, struct timeval *tvp) {
+    aeApiState *state = eventLoop->apidata;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned head, tail, waitNr = 1, flags = IORING_ENTER_GETEVENTS;
+    int rc, numevents = 0;
+
+    aeUringRearm(eventLoop);
+
+    memset(&arg, 0, sizeof(arg));
+    if (tvp) {
+        if (tvp->tv_sec == 0 && tvp->tv_usec == 0) {
+            waitNr = 0;
+        } else {
+            ts.tv_sec = tvp->tv_sec;
+            ts.tv_nsec = tvp->tv_usec*1000;
+            arg.ts = (uint64_t) (uintptr_t) &ts;
+        }
+    }
+    flags |= IORING_ENTER_EXT_ARG;
+
+    /* Submit every queued interest change and wait in one system call,
+     * unless completions are already there to be reaped. */
+    head = *state->cqHead;
+    tail = __atomic_load_n(state->cqTail, __ATOMIC_ACQUIRE);
+    if (head != tail) waitNr = 0;
+    if (waitNr || state->toSubmit) {
+        rc = aeUringEnter(state->ringfd, state->toSubmit, waitNr, flags,
+                &arg, sizeof(arg));
+        if (rc >= 0) {
+            state->toSubmit -= rc;
+        } else if (errno == EBUSY || errno == EAGAIN) {
+            /* Completion queue overflow: reap first, submit next time. */
+        } else if (errno != ETIME && errno != EINTR) {
+            return 0;
+        }
+    }
+
+    head = *state->cqHead;
+    tail = __atomic_load_n(state->cqTail, __ATOMIC_ACQUIRE);
+    while (head != tail && numevents < eventLoop->setsize) {
+        struct io_uring_cqe *cqe = &state->cqes[head & state->cqMask];
+        uint64_t data = cqe->user_data;
+        int op = AE_URING_DATA_OP(data);
+        int fd = AE_URING_DATA_FD(data);
+        int dir;
+
+        head++;
+        if (op >= AE_URING_OP_ACCEPT) {
+            aeUringComplete(eventLoop, op, fd, cqe->res, cqe->flags);
+            continue;
+        }
+        if (op != AE_URING_OP_POLL_IN && op != AE_URING_OP_POLL_OUT) continue;
+        dir = op == AE_URING_OP_POLL_IN ? AE_READABLE : AE_WRITABLE;
+        if (fd >= eventLoop->setsize ||
+            state->gen[fd*2 + (dir == AE_WRITABLE)] != AE_URING_DATA_GEN(data))
+            continue;
+
+        state->armed[fd] &= ~dir;
+        if (!state->rearm[fd]) {
+            state->rearm[fd] = 1;
+            state->rearmFds[state->rearmCount++] = fd;
+        }
+        if (cqe->res == -ECANCELED) continue;
+        /* Errors and hangups are reported like epoll does: the handler
+         * will find out about them on its next read or write. */
+        eventLoop->fired[numevents].fd = fd;
+        eventLoop->fired[numevents].mask = dir;
+        numevents++;
+    }
+    __atomic_store_n(state->cqHead, head, __ATOMIC_RELEASE);
+    return numevents;
+}
+
+static char *aeApiName(void) {
+    return "io_uring";
+}
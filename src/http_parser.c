@@ -389,6 +389,8 @@ enum http_host_state
   (ch == CR || ch == LF || ch == 9 || ((unsigned char)ch > 31 && ch != 127))
 
 #define start_state (parser->type == HTTP_REQUEST ? s_start_req : s_start_res)
+/* Set by the variants of http_parser_execute.i parsing nothing but requests */
+#define HTTP_PARSER_REQUEST_ONLY 0
 
 /* Map errno values to strings for human-readable output */
 #define HTTP_STRERROR_GEN(n, s) { "HPE_" #n, s },
@@ -486,6 +488,133 @@ http_parser_url_init(struct http_parser_url *u) {
   memset(u, 0, sizeof(*u));
 }
 
+/* Fast paths skipping runs of bytes which don't change the state of the
+ * parser: anything but CR and LF in a header value, plain URL characters in
+ * a path or query string. They return the first byte the state machine has
+ * to look at, or end. The SIMD versions are picked at load time. */
+typedef const char *(*http_scan_proc)(const char *p, const char *end, int high);
+
+/* '#' and '?' change the state of a URL, bytes with the high bit set are
+ * plain only in relaxed mode. */
+#define IS_PLAIN_URL_CHAR(c, high)                                   \
+  (((unsigned char) (c) > 0x20 && (unsigned char) (c) < 0x7f &&      \
+    (c) != '#' && (c) != '?') || ((high) && ((unsigned char) (c) & 0x80)))
+
+static const char *http_scan_crlf_generic(const char *p, const char *end, int high)
+{
+  (void) high;
+  for (; p < end; ++p) {
+    if (*p == CR || *p == LF) {
+      break;
+    }
+  }
+  return p;
+}
+
+static const char *http_scan_url_generic(const char *p, const char *end, int high)
+{
+  for (; p < end && IS_PLAIN_URL_CHAR(*p, high); ++p);
+  return p;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+
+__attribute__((target("sse4.2")))
+static const char *http_scan_crlf_sse42(const char *p, const char *end, int high)
+{
+  const __m128i crlf = _mm_setr_epi8(CR, LF, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+  int idx;
+  for (; end - p >= 16; p += 16) {
+    idx = _mm_cmpestri(crlf, 2, _mm_loadu_si128((const __m128i *) p), 16,
+        _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+    if (idx != 16) {
+      return p + idx;
+    }
+  }
+  return http_scan_crlf_generic(p, end, high);
+}
+
+__attribute__((target("sse4.2")))
+static const char *http_scan_url_sse42(const char *p, const char *end, int high)
+{
+  /* Pairs of inclusive ranges of plain characters. */
+  const __m128i ranges = _mm_setr_epi8(0x21, 0x22, 0x24, 0x3e, 0x40, 0x7e, (char) 0x80, (char) 0xff,
+      0, 0, 0, 0, 0, 0, 0, 0);
+  const int count = high ? 8 : 6;
+  int idx;
+  for (; end - p >= 16; p += 16) {
+    idx = _mm_cmpestri(ranges, count, _mm_loadu_si128((const __m128i *) p), 16,
+        _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_NEGATIVE_POLARITY | _SIDD_LEAST_SIGNIFICANT);
+    if (idx != 16) {
+      return p + idx;
+    }
+  }
+  return http_scan_url_generic(p, end, high);
+}
+
+__attribute__((target("avx2")))
+static const char *http_scan_crlf_avx2(const char *p, const char *end, int high)
+{
+  const __m256i cr = _mm256_set1_epi8(CR);
+  const __m256i lf = _mm256_set1_epi8(LF);
+  __m256i v;
+  uint32_t mask;
+  for (; end - p >= 32; p += 32) {
+    v = _mm256_loadu_si256((const __m256i *) p);
+    mask = (uint32_t) _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, lf)));
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+  return http_scan_crlf_sse42(p, end, high);
+}
+
+__attribute__((target("avx2")))
+static const char *http_scan_url_avx2(const char *p, const char *end, int high)
+{
+  const __m256i space = _mm256_set1_epi8(0x20);
+  const __m256i del = _mm256_set1_epi8(0x7f);
+  const __m256i hash = _mm256_set1_epi8('#');
+  const __m256i question = _mm256_set1_epi8('?');
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i v, plain;
+  uint32_t mask;
+  for (; end - p >= 32; p += 32) {
+    v = _mm256_loadu_si256((const __m256i *) p);
+    /* Signed compares: bytes with the high bit set are below 0x20. */
+    plain = _mm256_and_si256(_mm256_cmpgt_epi8(v, space), _mm256_cmpgt_epi8(del, v));
+    plain = _mm256_andnot_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, hash), _mm256_cmpeq_epi8(v, question)), plain);
+    if (high) {
+      plain = _mm256_or_si256(plain, _mm256_cmpgt_epi8(zero, v));
+    }
+    mask = ~(uint32_t) _mm256_movemask_epi8(plain);
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+  return http_scan_url_sse42(p, end, high);
+}
+#endif
+
+static http_scan_proc http_scan_crlf = http_scan_crlf_generic;
+static http_scan_proc http_scan_url = http_scan_url_generic;
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+__attribute__((constructor))
+static void http_scan_init(void)
+{
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    http_scan_crlf = http_scan_crlf_avx2;
+    http_scan_url = http_scan_url_avx2;
+  } else if (__builtin_cpu_supports("sse4.2")) {
+    http_scan_crlf = http_scan_crlf_sse42;
+    http_scan_url = http_scan_url_sse42;
+  }
+}
+#endif
+
 #undef HTTP_PARSE_STRICT
 #define HTTP_PARSE_STRICT 1
 #undef HTTP_PARSE_STRICT
@@ -505,6 +634,7 @@ do {                                                          \
 #define TOKEN(c)          STRICT_TOKEN(c)
 #define IS_URL_CHAR(c)    (BIT_AT(normal_url_char_strict, (unsigned char)c))
 #define IS_HOST_CHAR(c)   (IS_ALPHANUM(c) || (c) == '.' || (c) == '-')
+#define HTTP_PARSER_URL_HIGH 0
 #define HTTP_PARSER_EXECUTE_SYMBOL http_parser_execute_strict
 #define HTTP_PARSER_PARSE_URL_CHAR parse_url_char_strict
 #define HTTP_PARSER_PARSE_HOST_CHAR http_parse_host_char_strict
@@ -513,9 +643,21 @@ do {                                                          \
 #include "http_parser_parse_url_char.i"
 #include "http_parser_execute.i"
 #include "http_parser_parse_url.i"
+#undef HTTP_PARSER_EXECUTE_SYMBOL
+#undef HTTP_PARSER_REQUEST_ONLY
+#undef start_state
+#define HTTP_PARSER_REQUEST_ONLY 1
+#define start_state s_start_req
+#define HTTP_PARSER_EXECUTE_SYMBOL http_parser_execute_request_strict
+#include "http_parser_execute.i"
+#undef HTTP_PARSER_REQUEST_ONLY
+#undef start_state
+#define HTTP_PARSER_REQUEST_ONLY 0
+#define start_state (parser->type == HTTP_REQUEST ? s_start_req : s_start_res)
 #undef TOKEN
 #undef IS_URL_CHAR
 #undef IS_HOST_CHAR
+#undef HTTP_PARSER_URL_HIGH
 #undef HTTP_PARSER_EXECUTE_SYMBOL
 #undef HTTP_PARSER_PARSE_URL_CHAR
 #undef HTTP_PARSER_PARSE_HOST_CHAR
@@ -538,6 +680,7 @@ do {                                                          \
 #define IS_HOST_CHAR(c)   (IS_ALPHANUM(c) || (c) == '.' || (c) == '-' || (c) == '_')
 #define HTTP_PARSE_STRICT 0
 #undef HTTP_PARSE_STRICT
+#define HTTP_PARSER_URL_HIGH 1
 #define HTTP_PARSER_EXECUTE_SYMBOL http_parser_execute_relaxed
 #define HTTP_PARSER_PARSE_URL_CHAR parse_url_char_relaxed
 #define HTTP_PARSER_PARSE_HOST_CHAR http_parse_host_char_relaxed
@@ -546,9 +689,21 @@ do {                                                          \
 #include "http_parser_parse_url_char.i"
 #include "http_parser_execute.i"
 #include "http_parser_parse_url.i"
+#undef HTTP_PARSER_EXECUTE_SYMBOL
+#undef HTTP_PARSER_REQUEST_ONLY
+#undef start_state
+#define HTTP_PARSER_REQUEST_ONLY 1
+#define start_state s_start_req
+#define HTTP_PARSER_EXECUTE_SYMBOL http_parser_execute_request_relaxed
+#include "http_parser_execute.i"
+#undef HTTP_PARSER_REQUEST_ONLY
+#undef start_state
+#define HTTP_PARSER_REQUEST_ONLY 0
+#define start_state (parser->type == HTTP_REQUEST ? s_start_req : s_start_res)
 #undef TOKEN
 #undef IS_URL_CHAR
 #undef IS_HOST_CHAR
+#undef HTTP_PARSER_URL_HIGH
 #undef HTTP_PARSER_NORMAL_URL_CHAR
 #undef T
 
@@ -324,6 +324,16 @@ size_t http_parser_execute_relaxed(http_parser *parser,
                            const http_parser_settings *settings,
                            const char *data,
                            size_t len);
+/* Same as above for parsers initialized with HTTP_REQUEST only, the states
+ * of responses are compiled out. */
+size_t http_parser_execute_request_strict(http_parser *parser,
+                           const http_parser_settings *settings,
+                           const char *data,
+                           size_t len);
+size_t http_parser_execute_request_relaxed(http_parser *parser,
+                           const http_parser_settings *settings,
+                           const char *data,
+                           size_t len);
 
 
 /* If http_should_keep_alive() in the on_headers_complete or
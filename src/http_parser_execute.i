@@ -85,6 +85,7 @@ reexecute:
         SET_ERRNO(HPE_CLOSED_CONNECTION);
         goto error;
 
+#if !HTTP_PARSER_REQUEST_ONLY
       case s_start_req_or_res:
       {
         if (ch == CR || ch == LF)
@@ -317,6 +318,7 @@ reexecute:
         STRICT_CHECK(ch != LF);
         UPDATE_STATE(s_header_field_start);
         break;
+#endif
 
       case s_start_req:
       {
@@ -466,6 +468,18 @@ reexecute:
       case s_req_fragment_start:
       case s_req_fragment:
       {
+        if (CURRENT_STATE() == s_req_path || CURRENT_STATE() == s_req_query_string) {
+          /* Plain characters leave the state as it is, skip them. */
+          const char* run = http_scan_url(p, data + len, HTTP_PARSER_URL_HIGH);
+          if (run == data + len) {
+            COUNT_HEADER_SIZE(run - p - 1);
+            p = run - 1;
+            break;
+          }
+          COUNT_HEADER_SIZE(run - p);
+          p = run;
+          ch = *p;
+        }
         switch (ch) {
           case ' ':
             UPDATE_STATE(s_req_http_start);
@@ -901,21 +915,14 @@ reexecute:
           switch (h_state) {
             case h_general:
             {
-              const char* p_cr;
-              const char* p_lf;
+              const char* p_crlf;
               size_t limit = data + len - p;
 
               limit = MIN(limit, HTTP_MAX_HEADER_SIZE);
 
-              p_cr = (const char*) memchr(p, CR, limit);
-              p_lf = (const char*) memchr(p, LF, limit);
-              if (p_cr != NULL) {
-                if (p_lf != NULL && p_cr >= p_lf)
-                  p = p_lf;
-                else
-                  p = p_cr;
-              } else if (UNLIKELY(p_lf != NULL)) {
-                p = p_lf;
+              p_crlf = http_scan_crlf(p, p + limit, 0);
+              if (LIKELY(p_crlf != p + limit)) {
+                p = p_crlf;
               } else {
                 p = data + len;
               }
@@ -1232,7 +1239,7 @@ reexecute:
             /* Content-Length header given and non-zero */
             UPDATE_STATE(s_body_identity);
           } else {
-            if (!http_message_needs_eof(parser)) {
+            if (HTTP_PARSER_REQUEST_ONLY || !http_message_needs_eof(parser)) {
               /* Assume content-length 0 - read the next */
               UPDATE_STATE(NEW_MESSAGE());
               CALLBACK_NOTIFY(message_complete);
@@ -1445,7 +1452,9 @@ reexecute:
   CALLBACK_DATA_NOADVANCE(header_value);
   CALLBACK_DATA_NOADVANCE(url);
   CALLBACK_DATA_NOADVANCE(body);
+#if !HTTP_PARSER_REQUEST_ONLY
   CALLBACK_DATA_NOADVANCE(status);
+#endif
 
   RETURN(len);
 
@@ -4,10 +4,24 @@
 #include <string.h>
 #include <assert.h>
 #include <ctype.h>
+#include <limits.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#if defined(__GNUC__) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "server.h"
+#include "offload.h"
 #include "zmalloc.h"
 
+#if defined(IOV_MAX) && IOV_MAX < PROTO_WRITEV_MAX
+#undef PROTO_WRITEV_MAX
+#define PROTO_WRITEV_MAX IOV_MAX
+#endif
+
 static int onMessageBegin(http_parser *parser);
 static int onUrl(http_parser*, const char *at, size_t length);
 static int onStatus(http_parser*, const char *at, size_t length);
@@ -19,6 +33,7 @@ static int onMessageComplete(http_parser *parser);
 static int onChunkHeader(http_parser *parser);
 static int onChunkComplete(http_parser *parser);
 static void resetMessage(inginxMessage *message);
+static void messageFreeTables(inginxMessage *message);
 
 static http_parser_settings settings = {
   onMessageBegin,
@@ -169,84 +184,372 @@ static int clientHasPendingReplies(inginxClient *c) {
     return c->position || listLength(c->reply);
 }
 
-/* Write data in output buffers to client. Return C_OK if the client
- * is still valid after the call, C_ERR if it was freed. */
-static int writeToClient(aeEventLoop *el, int fd, inginxClient *c, int handler_installed) {
-  ssize_t nwritten = 0, totwritten = 0;
-  size_t objlen;
-  sds reply;
-  inginxServer *s = el->data;
+/* A reply node holds either an sds or the file range at the head of
+ * c->files, which can't share the address of a live sds. */
+static inline int clientReplyIsFile(inginxClient *c, listNode *ln) {
+  return c->files != NULL && listNodeValue(ln) == (void *) c->files;
+}
 
-  while (clientHasPendingReplies(c)) {
-    if (c->position > 0) {
-      nwritten = write(fd, c->buffer + c->sent, c->position - c->sent);
-      if (nwritten <= 0) break;
-      c->sent += nwritten;
-      totwritten += nwritten;
+/* Forget the file range at the head of c->files, its node is left to the
+ * caller. */
+static void clientReleaseFile(inginxClient *c) {
+  inginxReplyFile *file = c->files;
+  if ((c->files = file->next) == NULL) c->filesTail = NULL;
+  if (file->release) {
+    file->release(c->server, file->fd, file->opaque);
+  } else {
+    close(file->fd);
+  }
+  zfree(file);
+}
 
-      /* If the buffer was sent, set position to zero to continue with
-       * the remainder of the reply. */
-      if (c->sent == c->position) {
-        c->position = 0;
-        c->sent = 0;
-      }
+/* Account for nwritten bytes of the file range heading the reply. */
+static void clientConsumeFile(inginxClient *c, size_t nwritten) {
+  inginxReplyFile *file = c->files;
+  file->offset += nwritten;
+  file->length -= nwritten;
+  if (file->length == 0) {
+    clientReleaseFile(c);
+    listDelNode(c->reply, listFirst(c->reply));
+  }
+}
+
+/* PROTO_IOBUF_LEN bytes buffers are shared through a pool of the worker,
+ * idle clients don't hold any. */
+static char *serverTakeBuffer(inginxServer *s) {
+  char *buffer = s->buffers;
+  if (buffer == NULL) {
+    return zmalloc(PROTO_IOBUF_LEN);
+  }
+  s->buffers = *(char **) buffer;
+  s->freeBuffers--;
+  return buffer;
+}
+
+static void serverGiveBuffer(inginxServer *s, char *buffer) {
+  if (s->freeBuffers < PROTO_IOBUF_POOL_MAX) {
+    *(char **) buffer = s->buffers;
+    s->buffers = buffer;
+    s->freeBuffers++;
+  } else {
+    zfree(buffer);
+  }
+}
+
+static void clientAttachBuffer(inginxClient *c) {
+  c->buffer = serverTakeBuffer(c->server);
+}
+
+/* Give the output buffer back once everything in it was written. */
+static void clientReleaseBuffer(inginxClient *c) {
+  if (c->buffer == NULL || c->position > 0) return;
+  serverGiveBuffer(c->server, c->buffer);
+  c->buffer = NULL;
+}
+
+/* Make room for at least room more input bytes. */
+static void clientReserveInput(inginxClient *c, size_t room) {
+  char *input;
+  size_t size;
+  if (c->input == NULL) {
+    c->input = serverTakeBuffer(c->server);
+    c->inputSize = PROTO_IOBUF_LEN;
+  }
+  if (c->inputSize - c->inputLength >= room) return;
+  /* Only a head or a pipelined batch larger than the buffer gets here. */
+  for (size = c->inputSize * 2; size - c->inputLength < room; size *= 2);
+  input = zmalloc(size);
+  memcpy(input, c->input, c->inputLength);
+  if (c->inputSize == PROTO_IOBUF_LEN) {
+    serverGiveBuffer(c->server, c->input);
+  } else {
+    zfree(c->input);
+  }
+  c->input = input;
+  c->inputSize = size;
+}
+
+/* Give the input buffer back once there is nothing left to parse in it. */
+static void clientReleaseInput(inginxClient *c) {
+  if (c->input == NULL || c->inputLength > 0) return;
+  if (c->inputSize == PROTO_IOBUF_LEN) {
+    serverGiveBuffer(c->server, c->input);
+  } else {
+    zfree(c->input);
+  }
+  c->input = NULL;
+  c->inputSize = c->inputParsed = 0;
+}
+
+/* Take a client from the pool of the worker, or allocate a new one. A
+ * recycled client keeps its (empty) lists, everything else is zeroed. */
+inginxClient *inginxClientAllocate(inginxServer *s) {
+  inginxClient *c = s->freeClients;
+  inginxMessage kept;
+  list *reply;
+  if (c == NULL) {
+    s->clientsAllocated++;
+    c = zcalloc(sizeof(inginxClient));
+    c->reply = listCreate();
+    c->messageStart = -1;
+    c->pendingNode.value = c;
+    return c;
+  }
+  s->freeClients = c->next;
+  s->freeClientCount--;
+  s->clientsReused++;
+  kept = c->message;
+  reply = c->reply;
+  memset(c, 0, sizeof(inginxClient));
+  c->message.headers = kept.headers;
+  c->message.headerCapacity = kept.headerCapacity;
+  c->message.index = kept.index;
+  c->message.indexCapacity = kept.indexCapacity;
+  c->message.query = kept.query;
+  c->message.queryCapacity = kept.queryCapacity;
+  c->message.parameters = kept.parameters;
+  c->message.parameterCapacity = kept.parameterCapacity;
+  c->message.decoded = kept.decoded;
+  c->message.decodedCapacity = kept.decodedCapacity;
+  c->reply = reply;
+  c->messageStart = -1;
+  c->pendingNode.value = c;
+  return c;
+}
+
+/* Return a client whose message was already reset to the pool of the worker. */
+void inginxClientRecycle(inginxClient *c) {
+  inginxServer *s = c->server;
+  listNode *ln;
+  c->position = 0;
+  clientReleaseBuffer(c);
+  while ((ln = listFirst(c->reply)) != NULL) {
+    if (clientReplyIsFile(c, ln)) {
+      clientReleaseFile(c);
     } else {
-      reply = listNodeValue(listFirst(c->reply));
-      objlen = sdslen(reply);
+      sdsfree(listNodeValue(ln));
+    }
+    listDelNode(c->reply, ln);
+  }
+  c->inputLength = 0;
+  clientReleaseInput(c);
+  if (s->freeClientCount >= CLIENT_POOL_MAX) {
+    messageFreeTables(&c->message);
+    listRelease(c->reply);
+    zfree(c);
+    return;
+  }
+  c->next = s->freeClients;
+  s->freeClients = c;
+  s->freeClientCount++;
+}
 
-      if (objlen == 0) {
-        listDelNode(c->reply, listFirst(c->reply));
-        c->replyBytes -= objlen;
-        sdsfree(reply);
-        continue;
-      }
+/* Timeouts: every client waiting for something is linked in a slot of the
+ * timing wheel of its worker, at the nearest of its deadlines. Extending a
+ * deadline leaves the client where it is, it's moved when its slot expires,
+ * so the cost is proportional to the expiring clients only. */
+static void clientUnlinkTimeout(inginxClient *c) {
+  inginxServer *s = c->server;
+  if (c->wheelDeadline == 0) return;
+  if (c->wheelPrev) {
+    c->wheelPrev->wheelNext = c->wheelNext;
+  } else {
+    s->wheel[(c->wheelDeadline / TIMEOUT_WHEEL_RESOLUTION) & (TIMEOUT_WHEEL_SLOTS - 1)] = c->wheelNext;
+  }
+  if (c->wheelNext) c->wheelNext->wheelPrev = c->wheelPrev;
+  c->wheelPrev = c->wheelNext = NULL;
+  c->wheelDeadline = 0;
+}
 
-      nwritten = write(fd, reply + c->sent, objlen - c->sent);
-      if (nwritten <= 0) break;
-      c->sent += nwritten;
-      totwritten += nwritten;
-
-      /* If we fully sent the object on head go to the next one */
-      if (c->sent == objlen) {
-        listDelNode(c->reply, listFirst(c->reply));
-        c->sent = 0;
-        c->replyBytes -= objlen;
-        sdsfree(reply);
-      }
+static void clientScheduleTimeout(inginxClient *c) {
+  inginxServer *s = c->server;
+  int64_t deadline = c->readDeadline;
+  inginxClient **slot;
+  if (c->writeDeadline && (deadline == 0 || c->writeDeadline < deadline)) {
+    deadline = c->writeDeadline;
+  }
+  if (deadline == 0) {
+    clientUnlinkTimeout(c);
+    return;
+  }
+  if (c->wheelDeadline && c->wheelDeadline <= deadline) return;
+  clientUnlinkTimeout(c);
+  /* Slots before wheelTime already expired. */
+  if (deadline < s->wheelTime) deadline = s->wheelTime;
+  slot = s->wheel + ((deadline / TIMEOUT_WHEEL_RESOLUTION) & (TIMEOUT_WHEEL_SLOTS - 1));
+  c->wheelDeadline = deadline;
+  c->wheelNext = *slot;
+  if (*slot) (*slot)->wheelPrev = c;
+  *slot = c;
+}
+
+/* Start waiting for timeout on the read side, NONE disarms it. */
+static void clientArmReadTimeout(inginxClient *c, inginxClientTimeout timeout) {
+  inginxServer *s = c->server;
+  c->readTimeout = timeout;
+  c->readDeadline = s->timeouts[timeout] ? s->msTime + s->timeouts[timeout] : 0;
+  clientScheduleTimeout(c);
+}
+
+/* The write timeout runs while output is pending and is restarted by any
+ * progress, the idle one only starts once the reply is out. */
+static void clientUpdateWriteTimeout(inginxClient *c, int progressed) {
+  inginxServer *s = c->server;
+  if (!clientHasPendingReplies(c)) {
+    c->writeDeadline = 0;
+    if (c->readTimeout == CLIENT_TIMEOUT_IDLE) {
+      clientArmReadTimeout(c, CLIENT_TIMEOUT_IDLE);
+      return;
     }
-    /* Note that we avoid to send more than NET_MAX_WRITES_PER_EVENT
-     * bytes, in a single threaded server it's a good idea to serve
-     * other clients as well, even if a very large request comes from
-     * super fast link that is always able to accept data (in real world
-     * scenario think about 'KEYS *' against the loopback interface).
-     *
-     * However if we are over the maxmemory limit we ignore that and
-     * just deliver as much data as it is possible to deliver. */
-    /*
-       server.stat_net_output_bytes += totwritten;
-       if (totwritten > NET_MAX_WRITES_PER_EVENT &&
-       (server.maxmemory == 0 ||
-       zmalloc_used_memory() < server.maxmemory)) break;
-       */
-  }
-  if (nwritten == -1) {
-    if (errno == EAGAIN) {
-      nwritten = 0;
+  } else if (progressed || c->writeDeadline == 0) {
+    c->writeDeadline = s->timeouts[CLIENT_TIMEOUT_WRITE] ? s->msTime + s->timeouts[CLIENT_TIMEOUT_WRITE] : 0;
+  }
+  clientScheduleTimeout(c);
+}
+
+void inginxClientWaitRequest(inginxClient *c) {
+  clientArmReadTimeout(c, c->fd != -1 ? CLIENT_TIMEOUT_HEADER : CLIENT_TIMEOUT_NONE);
+}
+
+/* Return non-zero if the client was freed. */
+static int clientHandleTimeout(aeEventLoop *el, inginxClient *c, int64_t now) {
+  inginxServer *s = el->data;
+  if (c->writeDeadline && c->writeDeadline <= now) {
+    INGINX_LOG_DEBUG(s, "Timeout writing to client");
+    inginxClientFree(el, c);
+    return 1;
+  }
+  if (c->readDeadline && c->readDeadline <= now) {
+    if (c->readTimeout == CLIENT_TIMEOUT_IDLE && clientHasPendingReplies(c)) {
+      /* Still replying, idle starts over once done. */
+      c->readDeadline = 0;
     } else {
-      INGINX_LOG_TRACE(el->data, "Error writing to client: %s", inginxServerErrnoString(s));
+      INGINX_LOG_DEBUG(s, "Timeout reading from client (%s)",
+          c->readTimeout == CLIENT_TIMEOUT_IDLE ? "idle" :
+          c->readTimeout == CLIENT_TIMEOUT_HEADER ? "header" : "body");
       inginxClientFree(el, c);
-      return C_ERR;
+      return 1;
+    }
+  }
+  clientScheduleTimeout(c);
+  return 0;
+}
+
+void inginxClientsHandleTimeouts(aeEventLoop *el) {
+  inginxServer *s = el->data;
+  int64_t now = s->msTime;
+  int32_t slots = 0;
+  inginxClient *c, *next;
+
+  /* Only slots that are entirely in the past expire, what is found there
+   * belongs to a later turn of the wheel or was extended and is moved. */
+  while (s->wheelTime + TIMEOUT_WHEEL_RESOLUTION <= now) {
+    if (slots++ == TIMEOUT_WHEEL_SLOTS) {
+      /* Every slot was visited, skip the rest of the gap. */
+      s->wheelTime = now - now % TIMEOUT_WHEEL_RESOLUTION;
+      break;
+    }
+    c = s->wheel[(s->wheelTime / TIMEOUT_WHEEL_RESOLUTION) & (TIMEOUT_WHEEL_SLOTS - 1)];
+    s->wheel[(s->wheelTime / TIMEOUT_WHEEL_RESOLUTION) & (TIMEOUT_WHEEL_SLOTS - 1)] = NULL;
+    s->wheelTime += TIMEOUT_WHEEL_RESOLUTION;
+    while (c != NULL) {
+      next = c->wheelNext;
+      c->wheelPrev = c->wheelNext = NULL;
+      c->wheelDeadline = 0;
+      clientHandleTimeout(el, c, now);
+      c = next;
+    }
+  }
+}
+
+void inginxClientsFreePools(inginxServer *s) {
+  char *buffer;
+  inginxClient *c;
+  while ((buffer = s->buffers) != NULL) {
+    s->buffers = *(char **) buffer;
+    zfree(buffer);
+  }
+  s->freeBuffers = 0;
+  while ((c = s->freeClients) != NULL) {
+    s->freeClients = c->next;
+    messageFreeTables(&c->message);
+    listRelease(c->reply);
+    zfree(c);
+  }
+  s->freeClientCount = 0;
+}
+
+/* Collect up to max pending output buffers of the client, starting at the
+ * first byte not yet written, and return how many iov were filled. */
+static int clientGatherReplies(inginxClient *c, struct iovec *iov, int max) {
+  int count = 0;
+  size_t sent = c->sent;
+  listIter li;
+  listNode *ln;
+  sds reply;
+
+  if (c->position > 0 && count < max) {
+    iov[count].iov_base = c->buffer + sent;
+    iov[count].iov_len = c->position - sent;
+    count++;
+    sent = 0;
+  }
+  listRewind(c->reply, &li);
+  while (count < max && (ln = listNext(&li)) != NULL) {
+    /* Files are sent on their own, see clientSendFile(). */
+    if (clientReplyIsFile(c, ln)) break;
+    reply = listNodeValue(ln);
+    if (sdslen(reply) == sent) {
+      continue;
+    }
+    iov[count].iov_base = reply + sent;
+    iov[count].iov_len = sdslen(reply) - sent;
+    count++;
+    sent = 0;
+  }
+  return count;
+}
+
+/* Release the output buffers fully covered by nwritten bytes, as returned
+ * by a write of the buffers collected with clientGatherReplies(). */
+static void clientConsumeReplies(inginxClient *c, size_t nwritten) {
+  size_t objlen;
+  sds reply;
+
+  if (c->position > 0) {
+    objlen = c->position - c->sent;
+    if (nwritten < objlen) {
+      c->sent += nwritten;
+      return;
     }
+    nwritten -= objlen;
+    c->position = 0;
+    c->sent = 0;
+    clientReleaseBuffer(c);
   }
-  if (totwritten > 0) {
-    /* For clients representing masters we don't count sending data
-     * as an interaction, since we always send REPLCONF ACK commands
-     * that take some time to just fill the socket output buffer.
-     * We just rely on data / pings received for timeout detection. */
-    c->lastInteraction = s->unixTime;
+  while (listLength(c->reply)) {
+    if (clientReplyIsFile(c, listFirst(c->reply))) return;
+    reply = listNodeValue(listFirst(c->reply));
+    objlen = sdslen(reply) - c->sent;
+    if (nwritten < objlen) {
+      c->sent += nwritten;
+      return;
+    }
+    nwritten -= objlen;
+    c->sent = 0;
+    c->replyBytes -= sdslen(reply);
+    listDelNode(c->reply, listFirst(c->reply));
+    sdsfree(reply);
   }
+}
+
+/* Common end of a write attempt. Return C_OK if the client is still valid
+ * after the call, C_ERR if it was freed. */
+static int clientWritten(aeEventLoop *el, inginxClient *c, ssize_t totwritten, int handler_installed) {
+  clientUpdateWriteTimeout(c, totwritten > 0);
   if (!clientHasPendingReplies(c)) {
     c->sent = 0;
+    clientReleaseBuffer(c);
     if (handler_installed) aeDeleteFileEvent(el, c->fd, AE_WRITABLE);
 
     /* Close connection after entire reply has been sent. */
@@ -258,9 +561,153 @@ static int writeToClient(aeEventLoop *el, int fd, inginxClient *c, int handler_i
   return C_OK;
 }
 
+/* The file range heading the reply, if nothing is in front of it. */
+static inginxReplyFile *clientHeadFile(inginxClient *c) {
+  if (c->position > 0 || listLength(c->reply) == 0 || !clientReplyIsFile(c, listFirst(c->reply))) return NULL;
+  return c->files;
+}
+
+/* Read the next bytes of the file heading the reply into the output buffer,
+ * for sends that can't take a file. Return like read(), a file shorter than
+ * its range is an error. */
+static ssize_t clientFileToBuffer(inginxClient *c) {
+  inginxReplyFile *file = c->files;
+  ssize_t nread;
+  if (c->buffer == NULL) clientAttachBuffer(c);
+  nread = pread(file->fd, c->buffer, file->length < PROTO_IOBUF_LEN ? file->length : PROTO_IOBUF_LEN, file->offset);
+  if (nread == 0) {
+    errno = EIO;
+    return -1;
+  }
+  if (nread > 0) {
+    c->position = nread;
+    clientConsumeFile(c, nread);
+  }
+  return nread;
+}
+
+/* Send the file heading the reply, up to length bytes of it. Return like
+ * write(). */
+static ssize_t clientSendFile(inginxClient *c, size_t length) {
+#ifdef __linux__
+  inginxReplyFile *file = c->files;
+  off_t offset = file->offset;
+  ssize_t nwritten = sendfile(c->fd, file->fd, &offset, length);
+  if (nwritten == 0) {
+    errno = EIO;
+    return -1;
+  }
+  if (nwritten > 0) clientConsumeFile(c, nwritten);
+  return nwritten;
+#else
+  ssize_t nwritten;
+  if (clientFileToBuffer(c) < 0) return -1;
+  if ((nwritten = write(c->fd, c->buffer, c->position)) > 0) clientConsumeReplies(c, nwritten);
+  return nwritten;
+#endif
+}
+
+/* Write the pending output of the client, the buffer and up to
+ * PROTO_WRITEV_MAX reply nodes gathered in a single writev, file ranges
+ * with sendfile() once what is in front of them is out. Called right
+ * before the event loop goes to sleep, when the replies to every request of
+ * the last reads are queued so the responses to a batch of pipelined
+ * requests leave together, and by the write handler once the socket
+ * drained. A partial write leaves the rest for the next attempt, see
+ * clientConsumeReplies(). Return C_OK if the client is still valid after
+ * the call, C_ERR if it was freed. */
+static int writeToClient(aeEventLoop *el, inginxClient *c, int handler_installed) {
+  struct iovec iov[PROTO_WRITEV_MAX];
+  ssize_t nwritten = 0, totwritten = 0;
+  size_t length;
+  int count, idx;
+  inginxReplyFile *file;
+  inginxServer *s = el->data;
+
+  while (clientHasPendingReplies(c)) {
+    if ((file = clientHeadFile(c)) != NULL) {
+      length = file->length < PROTO_SENDFILE_MAX ? file->length : PROTO_SENDFILE_MAX;
+      if ((nwritten = clientSendFile(c, length)) <= 0) break;
+    } else {
+      if ((count = clientGatherReplies(c, iov, PROTO_WRITEV_MAX)) == 0) {
+        /* Drop empty replies left behind. */
+        clientConsumeReplies(c, 0);
+        continue;
+      }
+      for (length = 0, idx = 0; idx < count; ++idx) {
+        length += iov[idx].iov_len;
+      }
+      if ((nwritten = writev(c->fd, iov, count)) <= 0) break;
+      clientConsumeReplies(c, nwritten);
+    }
+    totwritten += nwritten;
+    /* Only keep going while the socket takes everything. */
+    if ((size_t) nwritten < length) break;
+  }
+  if (nwritten == -1 && errno != EAGAIN) {
+    INGINX_LOG_TRACE(s, "Error writing to client: %s", inginxServerErrnoString(s));
+    inginxClientFree(el, c);
+    return C_ERR;
+  }
+  return clientWritten(el, c, totwritten, handler_installed);
+}
+
 /* Write event handler. Just send data to the client. */
 static void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
-    writeToClient(el, fd, privdata, 1);
+    writeToClient(el, privdata, 1);
+}
+
+/* Completion handler of the send queued by sendToClient(). */
+static void sendToClientCompleted(aeEventLoop *el, int fd, void *privdata, long nwritten) {
+  inginxClient *c = privdata;
+  inginxServer *s = el->data;
+
+  c->flags &= ~CLIENT_SENDING;
+  if (nwritten < 0) {
+    INGINX_LOG_TRACE(s, "Error writing to client: %s", inginxServerErrnoString(s));
+    inginxClientFree(el, c);
+    return;
+  }
+  clientConsumeReplies(c, nwritten);
+  clientUpdateWriteTimeout(c, nwritten > 0);
+  if (clientHasPendingReplies(c)) {
+    /* Send the rest with the next batch, right before going to sleep. */
+    if (!(c->flags & CLIENT_PENDING_WRITE)) {
+      c->flags |= CLIENT_PENDING_WRITE;
+      listLinkNodeTail(s->pending, &c->pendingNode);
+    }
+  } else {
+    c->sent = 0;
+    clientReleaseBuffer(c);
+    if (c->flags & CLIENT_CLOSE_AFTER_REPLY) {
+      inginxClientFree(el, c);
+    }
+  }
+}
+
+/* Completion based counterpart of writeToClient(): queue a single gathering
+ * send of the pending output, it's submitted together with every other
+ * queued request when the event loop goes to sleep. The output buffers
+ * are not touched until the send completes. */
+static void sendToClient(aeEventLoop *el, inginxClient *c) {
+  struct iovec iov[AE_SEND_IOV_MAX];
+  int count;
+
+  if (c->flags & CLIENT_SENDING) return;
+  if (clientHeadFile(c) != NULL && clientFileToBuffer(c) < 0) {
+    inginxClientFreeAsync(c);
+    return;
+  }
+  count = clientGatherReplies(c, iov, AE_SEND_IOV_MAX);
+  if (count == 0) {
+    clientConsumeReplies(c, 0);
+    return;
+  }
+  if (aeSendv(el, c->fd, iov, count, sendToClientCompleted, c) == AE_ERR) {
+    inginxClientFreeAsync(c);
+    return;
+  }
+  c->flags |= CLIENT_SENDING;
 }
 
 /* This function is called just before entering the event loop, in the hope
@@ -277,10 +724,15 @@ int inginxClientsHandleWithPendingWrites(aeEventLoop *el) {
     while ((ln = listNext(&li))) {
         inginxClient *c = listNodeValue(ln);
         c->flags &= ~CLIENT_PENDING_WRITE;
-        listDelNode(s->pending, ln);
+        listUnlinkNode(s->pending, ln);
+
+        if (s->completion) {
+            sendToClient(el, c);
+            continue;
+        }
   
         /* Try to write buffers to the client socket. */
-        if (writeToClient(el, c->fd, c, 0) == C_ERR) continue;
+        if (writeToClient(el, c, 0) == C_ERR) continue;
   
         /* If there is nothing left, do nothing. Otherwise install
          * the write handler. */
@@ -301,6 +753,7 @@ void inginxClientFreeAsync(inginxClient *c) {
     if (c->flags & CLIENT_CLOSE_ASAP) return;
     c->flags |= CLIENT_CLOSE_ASAP;
     listAddNodeTail(c->server->closing, c);
+    c->closingNode = listLast(c->server->closing);
 }
 
 void inginxClientsFreeInAsyncFreeQueue(aeEventLoop *el) {
@@ -309,6 +762,7 @@ void inginxClientsFreeInAsyncFreeQueue(aeEventLoop *el) {
     listNode *ln = listFirst(s->closing);
     inginxClient *c = listNodeValue(ln);
     c->flags &= ~CLIENT_CLOSE_ASAP;
+    c->closingNode = NULL;
     inginxClientFree(el, c);
     listDelNode(s->closing,ln);
   }
@@ -318,7 +772,6 @@ void inginxClientsFreeInAsyncFreeQueue(aeEventLoop *el) {
  * be referenced, not including the Pub/Sub channels.
  * This is used by inginxClientFree() and replicationCacheMaster(). */
 static void unlinkClient(aeEventLoop *el, inginxClient *c) {
-    listNode *ln;
     inginxServer *s = el->data;
 
     /* If this is marked as current client unset it. */
@@ -329,36 +782,47 @@ static void unlinkClient(aeEventLoop *el, inginxClient *c) {
      * fd is already set to -1. */
     if (c->fd != -1) {
         /* Remove from the list of active clients. */
-        ln = listSearchKey(s->clients, c);
-        assert(ln != NULL);
-        listDelNode(s->clients, ln);
-
-        /* Unregister async I/O handlers and close the socket. */
-        aeDeleteFileEvent(el, c->fd, AE_READABLE);
-        aeDeleteFileEvent(el, c->fd, AE_WRITABLE);
-        close(c->fd);
+        if (c->clientNode) {
+            listDelNode(s->clients, c->clientNode);
+            c->clientNode = NULL;
+        }
+
+        /* Unregister async I/O handlers and close the socket. With completion
+         * based I/O this is left to inginxClientFree(), the kernel may still
+         * be reading from the output buffers. */
+        if (!s->completion) {
+            aeDeleteFileEvent(el, c->fd, AE_READABLE);
+            aeDeleteFileEvent(el, c->fd, AE_WRITABLE);
+            close(c->fd);
+        }
         c->fd = -1;
         inginxServerClientDisconnected(s, c);
     }
 
     /* Remove from the list of pending writes if needed. */
     if (c->flags & CLIENT_PENDING_WRITE) {
-        ln = listSearchKey(s->pending, c);
-        assert(ln != NULL);
-        listDelNode(s->pending, ln);
+        listUnlinkNode(s->pending, &c->pendingNode);
         c->flags &= ~CLIENT_PENDING_WRITE;
     }
 }
 
+/* Called once every completion based request of a freed client is gone. */
+static void inginxClientReleased(aeEventLoop *el, void *privdata) {
+    inginxClient *c = privdata;
+    close(c->fd);
+    inginxClientRecycle(c);
+}
+
 void inginxClientFree(aeEventLoop *el, inginxClient *c) {
-    listNode *ln;
     inginxServer *s = el->data;
+    int fd = c->fd;
+    clientUnlinkTimeout(c);
     /* Free data structures. */
-    listRelease(c->reply);
-    resetMessage(&c->message);
-    if (c->message.headers) {
-      listRelease(c->message.headers);
+    if (c->deferred) {
+        c->deferred->client = NULL;
+        c->deferred = NULL;
     }
+    resetMessage(&c->message);
 
     /* Unlink the client: this will close the socket, remove the I/O
      * handlers, and remove references of the client from different
@@ -368,12 +832,17 @@ void inginxClientFree(aeEventLoop *el, inginxClient *c) {
     /* If this client was scheduled for async freeing we need to remove it
      * from the queue. */
     if (c->flags & CLIENT_CLOSE_ASAP) {
-        ln = listSearchKey(s->closing, c);
-        assert(ln != NULL);
-        listDelNode(s->closing, ln);
+        assert(c->closingNode != NULL);
+        listDelNode(s->closing, c->closingNode);
+        c->closingNode = NULL;
     }
 
-    zfree(c);
+    if (s->completion && fd != -1) {
+        c->fd = fd;
+        aeDeleteCompletionEvents(el, fd, inginxClientReleased, c);
+        return;
+    }
+    inginxClientRecycle(c);
 }
 
 /* This function is called every time we are going to transmit new data
@@ -415,36 +884,13 @@ static int prepareClientToWrite(inginxClient *c) {
          * a system call. We'll only really install the write handler if
          * we'll not be able to write the whole reply at once. */
         c->flags |= CLIENT_PENDING_WRITE;
-        listAddNodeHead(c->server->pending, c);
+        listLinkNodeHead(c->server->pending, &c->pendingNode);
     }
 
     /* Authorize the caller to queue in the output buffer of this client. */
     return C_OK;
 }
 
-static int addReplyToBuffer(inginxClient *c, sds msg) {
-  size_t len = sdslen(msg);
-  size_t available = sizeof(c->buffer) - c->position;
-
-  if (c->flags & CLIENT_CLOSE_AFTER_REPLY) {
-    goto cleanupExit;
-  }
-
-  /* If there already are entries in the reply list, we cannot
-   * add anything more to the static buffer. */
-  if (listLength(c->reply) > 0) return C_ERR;
-
-  /* Check that the buffer has enough space available for this string. */
-  if (len > available) return C_ERR;
-
-  memcpy(c->buffer + c->position, msg, len);
-  c->position += len;
-
-cleanupExit:
-  sdsfree(msg);
-  return C_OK;
-}
-
 /* The function checks if the client reached output buffer soft or hard
  * limit, and also update the state needed to check the soft limit as
  * a side effect.
@@ -507,165 +953,713 @@ static void asyncCloseClientOnOutputBufferLimitReached(inginxClient *c) {
     }
 }
 
-static void addReplyToList(inginxClient *c, sds msg) {
-  size_t len;
-  if (c->flags & CLIENT_CLOSE_AFTER_REPLY) return;
+/* Room for the next bytes of the reply: the rest of the output buffer while
+ * nothing is queued after it, else the rest of the last reply block. NULL
+ * if a file range ends the reply. */
+static char *clientReplyRoom(inginxClient *c, size_t *available) {
+  listNode *ln = listLast(c->reply);
+  sds block;
+
+  if (ln == NULL) {
+    if (c->buffer == NULL) clientAttachBuffer(c);
+    *available = PROTO_IOBUF_LEN - c->position;
+    return c->buffer + c->position;
+  }
+  if (c->filesTail != NULL && listNodeValue(ln) == (void *) c->filesTail) {
+    *available = 0;
+    return NULL;
+  }
+  block = listNodeValue(ln);
+  *available = sdsavail(block);
+  return block + sdslen(block);
+}
+
+/* Room for at least size more bytes at the end of the reply, formatted in
+ * place and appended by clientCommitReply(). When what is left is too small
+ * a block of at least PROTO_REPLY_CHUNK_BYTES is queued, so small writes
+ * share the output buffer or the last block instead of allocating each.
+ * NULL if the client doesn't take replies anymore. */
+static char *clientReserveReply(inginxClient *c, size_t size, size_t *available) {
+  char *room;
+  sds block;
+
+  if (prepareClientToWrite(c) != C_OK || (c->flags & CLIENT_CLOSE_AFTER_REPLY)) return NULL;
+  if ((room = clientReplyRoom(c, available)) != NULL && *available >= size) return room;
+  block = sdsMakeRoomForNonGreedy(sdsempty(), size > PROTO_REPLY_CHUNK_BYTES ? size : PROTO_REPLY_CHUNK_BYTES);
+  listAddNodeTail(c->reply, block);
+  *available = sdsavail(block);
+  return block;
+}
+
+/* Append the first length bytes of the room of the last
+ * clientReserveReply(). */
+static void clientCommitReply(inginxClient *c, size_t length) {
+  sds block;
 
-  len = sdslen(msg);
   if (listLength(c->reply) == 0) {
-    listAddNodeTail(c->reply, msg);
-    c->replyBytes += len;
-  } else {
-    listAddNodeTail(c->reply, msg);
-    c->replyBytes += len;
+    c->position += length;
+    return;
   }
+  block = listNodeValue(listLast(c->reply));
+  sdsIncrLen(block, length);
+  c->replyBytes += length;
   asyncCloseClientOnOutputBufferLimitReached(c);
 }
 
-static void addReply(inginxClient *c, sds msg)
-{
-  if (prepareClientToWrite(c) != C_OK) return;
-
-  /* This is an important place where we can avoid copy-on-write
-   * when there is a saving child running, avoiding touching the
-   * refcount field of the object if it's not needed.
-   *
-   * If the encoding is RAW and there is room in the static buffer
-   * we'll be able to send the object to the client without
-   * messing with its page. */
-  if (addReplyToBuffer(c, msg) != C_OK) addReplyToList(c, msg);
+/* Copy length bytes at the end of the reply, filling what is left of the
+ * buffer or the last block before queueing a block for the rest. */
+static void clientAddReplyData(inginxClient *c, const void *data, size_t length) {
+  size_t available, chunk;
+  char *room;
+
+  if ((room = clientReserveReply(c, 0, &available)) == NULL || length == 0) return;
+  chunk = length < available ? length : available;
+  memcpy(room, data, chunk);
+  clientCommitReply(c, chunk);
+  if (chunk == length) return;
+  room = clientReserveReply(c, length - chunk, &available);
+  memcpy(room, (const char *) data + chunk, length - chunk);
+  clientCommitReply(c, length - chunk);
 }
 
-void inginxClientReadFrom(aeEventLoop *el, int fd, void *privdata, int mask)
-{
-  inginxClient *c = privdata;
-  char buffer[8 * 1024];
-  ssize_t parsed;
-  inginxServer *s = el->data;
-  ssize_t nread = read(c->fd, buffer, sizeof(buffer));
-  if (nread < 0) {
-    INGINX_LOG_DEBUG(s, "Could not read from fd %d. %s", fd, inginxServerErrnoString(s));
-    inginxClientFree(el, c);
-    return;
-  } else if (nread == 0) {
-    INGINX_LOG_DEBUG(s, "Client closed connection");
-    inginxClientFree(el, c);
-    return;
-  }
-  parsed = s->parser(&c->parser, &settings, buffer, nread);
-  if (c->parser.upgrade) {
-    INGINX_LOG_WARN(s, "HTTP upgrade is not supported");
-    inginxClientSendError(c, 500);
-    return;
-  }
-  if (parsed != nread) {
-    INGINX_LOG_WARN(s, "Invalid protocol when trying to parse request");
-    inginxClientSendError(c, 400);
-    inginxClientClose(c);
-    return;
+/* Format in the room of the reply, skip bytes past its start so the caller
+ * can write in front and leaving at least tail bytes after. Return the
+ * room, with the formatted length in *length, for the caller to commit.
+ * NULL if nothing can be added. */
+static char *clientReserveVPrintf(inginxClient *c, size_t skip, size_t tail, size_t *length, const char *fmt, va_list args) {
+  size_t available;
+  char *room;
+  va_list copy;
+  int n;
+
+  if ((room = clientReserveReply(c, skip + tail + 1, &available)) == NULL) return NULL;
+  va_copy(copy, args);
+  n = vsnprintf(room + skip, available - skip - tail, fmt, copy);
+  va_end(copy);
+  if (n < 0) return NULL;
+  if ((size_t) n >= available - skip - tail) {
+    /* Didn't fit, again in a block large enough. */
+    if ((room = clientReserveReply(c, skip + n + tail + 1, &available)) == NULL) return NULL;
+    vsnprintf(room + skip, available - skip - tail, fmt, args);
   }
+  *length = n;
+  return room;
 }
 
-static int onMessageBegin(http_parser *parser)
-{
-  inginxClient *c = parser->data;
-  c->state = INGINX_CLIENT_STATE_BEGIN;
-  return 0;
+#ifdef __GNUC__
+static void clientAddReplyPrintf(inginxClient *c, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+#endif
+
+static void clientAddReplyPrintf(inginxClient *c, const char *fmt, ...) {
+  size_t length;
+  va_list ap;
+
+  va_start(ap, fmt);
+  if (clientReserveVPrintf(c, 0, 0, &length, fmt, ap) != NULL) clientCommitReply(c, length);
+  va_end(ap);
 }
 
-static int onUrl(http_parser *parser, const char *at, size_t length)
+/* Drop the input that isn't needed anymore: everything before the request
+ * being parsed and, once its head is complete, the body bytes parsed after
+ * it. What is kept moves to the front of the buffer. */
+static void clientCompactInput(inginxClient *c)
 {
-  inginxClient *c = parser->data;
-  if (c->message.url == NULL) {
-    c->message.url = sdsnewlen(at, length);
+  size_t keep, unparsed = c->inputLength - c->inputParsed;
+  if (c->messageStart < 0) {
+    keep = 0;
   } else {
-    c->message.url = sdscatlen(c->message.url, at, length);
+    keep = c->message.headLength ? c->message.headLength : c->inputParsed - c->messageStart;
+    if (c->messageStart > 0) {
+      memmove(c->input, c->input + c->messageStart, keep);
+      c->messageStart = 0;
+    }
   }
-  c->state = INGINX_CLIENT_STATE_URL;
-  return 0;
+  if (keep != c->inputParsed && unparsed > 0) {
+    memmove(c->input + keep, c->input + c->inputParsed, unparsed);
+  }
+  c->inputParsed = keep;
+  c->inputLength = keep + unparsed;
+  clientReleaseInput(c);
 }
 
-static int onStatus(http_parser *parser, const char *at, size_t length)
+/* Forget the input of a client that won't parse anything anymore. */
+static void clientDropInput(inginxClient *c)
 {
-  inginxClient *c = parser->data;
-  c->state = INGINX_CLIENT_STATE_STATUS;
-  return 0;
+  c->inputLength = c->inputParsed = 0;
+  c->messageStart = -1;
+  clientReleaseInput(c);
 }
 
-static int onHeaderField(http_parser *parser, const char *at, size_t length)
+/* Answer a request that can't be processed and close the connection once
+ * the reply was sent. Returns what stops the parser from a callback. */
+static int clientReject(inginxClient *c, int32_t code)
 {
-  inginxClient *c = parser->data;
-  if (c->field == NULL) {
-    c->field = sdsnewlen(at, length);
-    if (c->value != NULL) {
-      listAddNodeTail(c->message.headers, c->value);
-      c->value = NULL;
-    }
-  } else {
-    c->field = sdscatlen(c->field, at, length);
-  }
-  c->state = INGINX_CLIENT_STATE_HEADER_FIELD;
-  return 0;
+  INGINX_LOG_DEBUG(c->server, "Rejecting request of client %llu with %d", (unsigned long long) c->id, code);
+  /* The version may not be parsed yet. */
+  c->message.major = c->message.minor = 1;
+  c->lengthSent = 0;
+  inginxClientSendError(c, code);
+  inginxClientAddHeader(c, "Connection", "close");
+  inginxClientAddBodySize(c, NULL, 0);
+  inginxClientClose(c);
+  return -1;
 }
 
-static int onHeaderValue(http_parser *parser, const char *at, size_t length)
+/* Stop reading from the socket of the client. With completion based I/O
+ * the multishot recv is cancelled, what the kernel received before that
+ * still arrives. */
+static void clientStopReading(inginxClient *c)
 {
-  inginxClient *c = parser->data;
-  if (c->value == NULL) {
-    assert(c->field);
-    listAddNodeTail(c->message.headers, c->field);
-    c->field = NULL;
-    c->value = sdsnewlen(at, length);
+  inginxServer *s = c->server;
+  if (c->fd == -1 || (c->flags & CLIENT_READ_STOPPED)) {
+    return;
+  }
+  c->flags |= CLIENT_READ_STOPPED;
+  if (s->completion) {
+    aeDeleteRecvEvent(s->el, c->fd);
   } else {
-    c->value = sdscatlen(c->value, at, length);
+    aeDeleteFileEvent(s->el, c->fd, AE_READABLE);
   }
-  c->state = INGINX_CLIENT_STATE_HEADER_VALUE;
-  return 0;
 }
 
-static int onHeadersComplete(http_parser *parser)
+/* Read from the socket again after clientStopReading(). */
+static int clientStartReading(inginxClient *c)
 {
-  inginxClient *c = parser->data;
-  if (c->value != NULL) {
-    listAddNodeTail(c->message.headers, c->value);
-    c->value = NULL;
+  inginxServer *s = c->server;
+  if (c->fd == -1 || !(c->flags & CLIENT_READ_STOPPED)) {
+    return C_OK;
   }
-  c->state = INGINX_CLIENT_STATE_HEADER_COMPLETE;
-  return 0;
-}
+  c->flags &= ~CLIENT_READ_STOPPED;
+  if ((s->completion ? aeCreateRecvEvent(s->el, c->fd, inginxClientRecvFrom, c) :
+      aeCreateFileEvent(s->el, c->fd, AE_READABLE, inginxClientReadFrom, c)) == AE_ERR) {
+    return C_ERR;
+  }
+  return C_OK;
+}
+
+/* Parse what was received since the last call. */
+static void processInputBuffer(inginxClient *c)
+{
+  inginxServer *s = c->server;
+  size_t length;
+  ssize_t parsed;
+  if (c->flags & CLIENT_CLOSE_AFTER_REPLY) {
+    /* Nothing would be answered anymore. */
+    clientDropInput(c);
+    return;
+  }
+  if (c->deferred) {
+    /* Keep what arrives behind a deferred request until it was answered,
+     * reading goes on to notice disconnections until too much piled up. */
+    if (c->inputLength - c->inputParsed >= PROTO_INLINE_MAX_SIZE) {
+      clientStopReading(c);
+    }
+    return;
+  }
+  if (c->flags & CLIENT_READ_PAUSED) {
+    return;
+  }
+  length = c->inputLength - c->inputParsed;
+  c->flags |= CLIENT_PARSING;
+  parsed = s->parser(&c->parser, &settings, c->input + c->inputParsed, length);
+  c->flags &= ~CLIENT_PARSING;
+  c->inputParsed += parsed;
+  if (c->flags & CLIENT_CLOSE_AFTER_REPLY) {
+    /* Rejected by a callback or closed by the listener, drop the rest. */
+    clientDropInput(c);
+    return;
+  }
+  if (c->parser.upgrade) {
+    INGINX_LOG_WARN(s, "HTTP upgrade is not supported");
+    inginxClientSendError(c, 500);
+    return;
+  }
+  /* A paused parser stopped right after a deferred request or where the
+   * input was paused. */
+  if (HTTP_PARSER_ERRNO(&c->parser) != HPE_PAUSED && parsed != length) {
+    INGINX_LOG_WARN(s, "Invalid protocol when trying to parse request");
+    clientReject(c, HTTP_PARSER_ERRNO(&c->parser) == HPE_HEADER_OVERFLOW ? 431 : 400);
+    return;
+  }
+  clientCompactInput(c);
+}
+
+/* Room left in the body reserved from Content-Length when the next bytes of
+ * the client can only be body, 0 otherwise. */
+static size_t clientBodyRoom(inginxClient *c)
+{
+  http_parser *parser = &c->parser;
+  sds body = c->message.body;
+  if (body == NULL || c->inputParsed != c->inputLength || c->deferred ||
+      (c->flags & (CLIENT_READ_PAUSED | CLIENT_CLOSE_AFTER_REPLY))) {
+    return 0;
+  }
+  if ((c->state != INGINX_CLIENT_STATE_HEADER_COMPLETE && c->state != INGINX_CLIENT_STATE_BODY) ||
+      HTTP_PARSER_ERRNO(parser) != HPE_OK || parser->upgrade || (parser->flags & F_CHUNKED) ||
+      parser->content_length == 0 || parser->content_length == ULLONG_MAX) {
+    return 0;
+  }
+  return parser->content_length < sdsavail(body) ? parser->content_length : sdsavail(body);
+}
+
+/* Parse body bytes that were put straight at the end of the reserved body,
+ * onBody only has to account for them. */
+static void processReservedBody(inginxClient *c, const char *at, size_t length)
+{
+  inginxServer *s = c->server;
+  ssize_t parsed;
+  c->flags |= CLIENT_PARSING;
+  parsed = s->parser(&c->parser, &settings, at, length);
+  c->flags &= ~CLIENT_PARSING;
+  if (c->flags & CLIENT_CLOSE_AFTER_REPLY) {
+    clientDropInput(c);
+    return;
+  }
+  if (HTTP_PARSER_ERRNO(&c->parser) != HPE_PAUSED && (size_t) parsed != length) {
+    INGINX_LOG_WARN(s, "Invalid protocol when trying to parse request");
+    clientReject(c, 400);
+    return;
+  }
+  /* The head is not needed anymore once the request was dispatched. */
+  clientCompactInput(c);
+}
+
+void inginxClientReadFrom(aeEventLoop *el, int fd, void *privdata, int mask)
+{
+  inginxClient *c = privdata;
+  inginxServer *s = el->data;
+  ssize_t nread;
+  size_t room;
+  char *at;
+  int32_t reads = 0;
+  /* Every request of a pipelining client found while draining the socket
+   * is dispatched before the replies are written, they are coalesced
+   * before the event loop goes to sleep. A read filling the buffer means
+   * more is likely waiting, up to PROTO_READS_PER_EVENT reads are done so
+   * that other clients get their turn. */
+  do {
+    if ((room = clientBodyRoom(c)) >= PROTO_BODY_DIRECT_MIN) {
+      /* The rest of a large body goes where it's kept, without a copy. */
+      at = c->message.body + sdslen(c->message.body);
+    } else {
+      /* Read straight behind what was received so far, the head of a
+       * request is parsed in place. */
+      clientReserveInput(c, PROTO_READ_MIN_ROOM);
+      room = c->inputSize - c->inputLength;
+      at = c->input + c->inputLength;
+    }
+    nread = read(c->fd, at, room);
+    if (nread < 0) {
+      if (errno == EAGAIN) {
+        clientReleaseInput(c);
+        return;
+      }
+      INGINX_LOG_DEBUG(s, "Could not read from fd %d. %s", fd, inginxServerErrnoString(s));
+      inginxClientFree(el, c);
+      return;
+    } else if (nread == 0) {
+      INGINX_LOG_DEBUG(s, "Client closed connection");
+      inginxClientFree(el, c);
+      return;
+    }
+    if (at != c->input + c->inputLength) {
+      processReservedBody(c, at, nread);
+      continue;
+    }
+    c->inputLength += nread;
+    processInputBuffer(c);
+  } while ((size_t) nread == room && ++reads < PROTO_READS_PER_EVENT && c->deferred == NULL &&
+      !(c->flags & (CLIENT_CLOSE_AFTER_REPLY | CLIENT_CLOSE_ASAP | CLIENT_READ_PAUSED)));
+}
+
+/* Completion based counterpart of inginxClientReadFrom(), buffer is owned by
+ * the event loop and only valid for the duration of the call. */
+void inginxClientRecvFrom(aeEventLoop *el, int fd, void *privdata, const char *buffer, long nread)
+{
+  inginxClient *c = privdata;
+  inginxServer *s = el->data;
+  if (nread < 0) {
+    INGINX_LOG_DEBUG(s, "Could not read from fd %d. %s", fd, inginxServerErrnoString(s));
+    inginxClientFree(el, c);
+    return;
+  } else if (nread == 0) {
+    INGINX_LOG_DEBUG(s, "Client closed connection");
+    inginxClientFree(el, c);
+    return;
+  }
+  if (clientBodyRoom(c) >= (size_t) nread) {
+    /* Only body in there, copy it where it's kept rather than twice. */
+    memcpy(c->message.body + sdslen(c->message.body), buffer, nread);
+    processReservedBody(c, c->message.body + sdslen(c->message.body), nread);
+    return;
+  }
+  clientReserveInput(c, nread);
+  memcpy(c->input + c->inputLength, buffer, nread);
+  c->inputLength += nread;
+  processInputBuffer(c);
+}
+
+/* Add a piece of a token to its slice. Pieces of a token follow each other
+ * in the input buffer, unless the parser skipped something in between
+ * (folded header lines): the piece is then moved over the skipped bytes. */
+static void clientSliceAppend(inginxClient *c, inginxSlice *slice, const char *at, size_t length, int first)
+{
+  char *base = c->input + c->messageStart;
+  char *end = base + slice->offset + slice->length;
+  if (first) {
+    slice->offset = at - base;
+    slice->length = length;
+    return;
+  }
+  if (end != at) {
+    memmove(end, at, length);
+  }
+  slice->length += length;
+}
+
+static int onMessageBegin(http_parser *parser)
+{
+  inginxClient *c = parser->data;
+  c->state = INGINX_CLIENT_STATE_BEGIN;
+  c->bodyLength = 0;
+  /* The header timeout covers the whole head of the request. */
+  if (c->readTimeout != CLIENT_TIMEOUT_HEADER) {
+    clientArmReadTimeout(c, CLIENT_TIMEOUT_HEADER);
+  }
+  return 0;
+}
+
+static int onUrl(http_parser *parser, const char *at, size_t length)
+{
+  inginxClient *c = parser->data;
+  if (c->messageStart < 0) {
+    /* Slices of the message are relative to the start of its url. */
+    c->messageStart = at - c->input;
+  }
+  clientSliceAppend(c, &c->message.url, at, length, c->state != INGINX_CLIENT_STATE_URL);
+  c->state = INGINX_CLIENT_STATE_URL;
+  if (c->server->limits[REQUEST_LIMIT_URL] && c->message.url.length > c->server->limits[REQUEST_LIMIT_URL]) {
+    return clientReject(c, 414);
+  }
+  return 0;
+}
+
+static int onStatus(http_parser *parser, const char *at, size_t length)
+{
+  inginxClient *c = parser->data;
+  c->state = INGINX_CLIENT_STATE_STATUS;
+  return 0;
+}
+
+/* Names of inginxHeaderId */
+static const char *headerNames[INGINX_HEADER_COUNT] = {
+  NULL,
+  "Accept",
+  "Accept-Charset",
+  "Accept-Encoding",
+  "Accept-Language",
+  "Authorization",
+  "Cache-Control",
+  "Connection",
+  "Content-Encoding",
+  "Content-Length",
+  "Content-Type",
+  "Cookie",
+  "Expect",
+  "Forwarded",
+  "Host",
+  "If-Match",
+  "If-Modified-Since",
+  "If-None-Match",
+  "If-Range",
+  "If-Unmodified-Since",
+  "Origin",
+  "Pragma",
+  "Range",
+  "Referer",
+  "Transfer-Encoding",
+  "Upgrade",
+  "User-Agent",
+  "X-Forwarded-For",
+  "X-Forwarded-Proto",
+  "X-Real-IP",
+  "X-Requested-With",
+};
+
+/* Case insensitive FNV-1a. With this seed the top HEADER_SLOT_BITS of the
+ * hashes of the well-known names are all different, which makes headerSlots
+ * a perfect hash table: a name added to inginxHeaderId needs a new seed. */
+#define HEADER_HASH_SEED 0x811cb966
+#define HEADER_SLOT_BITS 6
+
+static const uint8_t headerSlots[1 << HEADER_SLOT_BITS] = {
+  27,  0, 29,  0,  0,  0,  0,  7,  0,  0, 24,  0,  0, 17,  0,  0,
+   8,  0,  0,  2, 20,  3, 28, 13,  0,  0,  0,  0,  0,  0,  0, 23,
+  16,  0,  0,  0, 10,  0, 11,  0, 22, 26,  5,  0,  6,  0, 21, 15,
+   0, 14, 18, 19,  0,  1, 30,  0,  0,  0, 12,  9,  0, 25,  0,  4,
+};
+
+#define HEADER_INDEX_MIN 16
+#define HEADER_INDEX_SLOT(hash, slots) (((hash) ^ ((hash) >> 16)) & ((slots) - 1))
+
+static uint32_t headerHash(const char *name)
+{
+  uint32_t hash = HEADER_HASH_SEED;
+  for (; *name; ++name) {
+    hash = (hash ^ (uint8_t) (*name | 0x20)) * 16777619;
+  }
+  return hash;
+}
+
+static inginxHeaderId headerIdOf(const char *name, uint32_t hash)
+{
+  inginxHeaderId id = headerSlots[hash >> (32 - HEADER_SLOT_BITS)];
+  if (id != INGINX_HEADER_UNKNOWN && strcasecmp(headerNames[id], name) != 0) {
+    return INGINX_HEADER_UNKNOWN;
+  }
+  return id;
+}
+
+/* Index the headers of a complete head. Well-known names get their slot in
+ * known, the other ones go to the open addressing table. Headers of the
+ * same name are chained in order through next. */
+static void messageIndexHeaders(inginxMessage *m, const char *base)
+{
+  int32_t last[INGINX_HEADER_COUNT];
+  int32_t idx, slot, slots, entry;
+  inginxHeader *header;
+  const char *name;
+  uint32_t hash;
+  inginxHeaderId id;
+  for (slots = HEADER_INDEX_MIN; slots < m->headerCount * 2; slots *= 2);
+  for (idx = 0; idx < m->headerCount; ++idx) {
+    header = m->headers + idx;
+    header->next = 0;
+    name = base + header->name.offset;
+    hash = headerHash(name);
+    if ((id = headerIdOf(name, hash)) != INGINX_HEADER_UNKNOWN) {
+      if (m->known[id] == 0) {
+        m->known[id] = idx + 1;
+      } else {
+        m->headers[last[id] - 1].next = idx + 1;
+      }
+      last[id] = idx + 1;
+      continue;
+    }
+    if (m->indexSlots == 0) {
+      if (m->indexCapacity < slots) {
+        zfree(m->index);
+        m->index = zmalloc(sizeof(int32_t) * slots);
+        m->indexCapacity = slots;
+      }
+      memset(m->index, 0, sizeof(int32_t) * slots);
+      m->indexSlots = slots;
+    }
+    for (slot = HEADER_INDEX_SLOT(hash, slots); (entry = m->index[slot]) != 0; slot = (slot + 1) & (slots - 1)) {
+      if (strcasecmp(base + m->headers[entry - 1].name.offset, name) == 0) {
+        break;
+      }
+    }
+    if (entry == 0) {
+      m->index[slot] = idx + 1;
+      continue;
+    }
+    while (m->headers[entry - 1].next != 0) {
+      entry = m->headers[entry - 1].next;
+    }
+    m->headers[entry - 1].next = idx + 1;
+  }
+}
+
+/* 1 + index of the first header named field, 0 if there is none. */
+static int32_t messageFindHeader(const inginxMessage *m, const char *field)
+{
+  uint32_t hash = headerHash(field);
+  inginxHeaderId id = headerIdOf(field, hash);
+  int32_t slot, entry, slots = m->indexSlots;
+  if (id != INGINX_HEADER_UNKNOWN) {
+    return m->known[id];
+  }
+  if (slots == 0) {
+    return 0;
+  }
+  for (slot = HEADER_INDEX_SLOT(hash, slots); (entry = m->index[slot]) != 0; slot = (slot + 1) & (slots - 1)) {
+    if (strcasecmp(m->base + m->headers[entry - 1].name.offset, field) == 0) {
+      return entry;
+    }
+  }
+  return 0;
+}
+
+/* Value of the header at entry, or of the one following cursor in its chain. */
+static const char *messageHeaderValue(const inginxMessage *m, int32_t entry, const char *cursor)
+{
+  const inginxHeader *header;
+  const char *value;
+  while (entry != 0) {
+    header = m->headers + entry - 1;
+    value = m->base + header->value.offset;
+    if (cursor == NULL) {
+      return value;
+    }
+    if (value == cursor) {
+      cursor = NULL;
+    }
+    entry = header->next;
+  }
+  return NULL;
+}
+
+/* Whether the head of the request, up to the end of at, has more bytes past
+ * the url than allowed. Positions in the input are the ones on the wire. */
+static int clientHeadersOverflow(inginxClient *c, const char *at, size_t length)
+{
+  int64_t limit = c->server->limits[REQUEST_LIMIT_HEADER_BYTES];
+  const char *start;
+  if (limit == 0 || c->messageStart < 0) {
+    return 0;
+  }
+  start = c->input + c->messageStart + c->message.url.offset + c->message.url.length;
+  return at + length - start > limit;
+}
+
+static int onHeaderField(http_parser *parser, const char *at, size_t length)
+{
+  inginxClient *c = parser->data;
+  inginxMessage *m = &c->message;
+  inginxHeader *header;
+  if (clientHeadersOverflow(c, at, length)) {
+    return clientReject(c, 431);
+  }
+  if (c->state != INGINX_CLIENT_STATE_HEADER_FIELD) {
+    if (c->server->limits[REQUEST_LIMIT_HEADER_COUNT] && m->headerCount >= c->server->limits[REQUEST_LIMIT_HEADER_COUNT]) {
+      return clientReject(c, 431);
+    }
+    if (m->headerCount == m->headerCapacity) {
+      m->headerCapacity = m->headerCapacity ? m->headerCapacity * 2 : 16;
+      m->headers = zrealloc(m->headers, sizeof(inginxHeader) * m->headerCapacity);
+    }
+    header = m->headers + m->headerCount++;
+    header->value.offset = header->value.length = 0;
+    clientSliceAppend(c, &header->name, at, length, 1);
+  } else {
+    clientSliceAppend(c, &m->headers[m->headerCount - 1].name, at, length, 0);
+  }
+  c->state = INGINX_CLIENT_STATE_HEADER_FIELD;
+  return 0;
+}
+
+static int onHeaderValue(http_parser *parser, const char *at, size_t length)
+{
+  inginxClient *c = parser->data;
+  inginxMessage *m = &c->message;
+  assert(m->headerCount > 0);
+  if (clientHeadersOverflow(c, at, length)) {
+    return clientReject(c, 431);
+  }
+  clientSliceAppend(c, &m->headers[m->headerCount - 1].value, at, length,
+      c->state != INGINX_CLIENT_STATE_HEADER_VALUE);
+  c->state = INGINX_CLIENT_STATE_HEADER_VALUE;
+  return 0;
+}
+
+/* NUL terminate a slice over the byte following it (a space, a colon or a
+ * line break already parsed), return the length of the head it covers. */
+static uint32_t terminateSlice(char *base, inginxSlice *slice)
+{
+  base[slice->offset + slice->length] = '\0';
+  return slice->offset + slice->length + 1;
+}
+
+static int onHeadersComplete(http_parser *parser)
+{
+  inginxClient *c = parser->data;
+  inginxMessage *m = &c->message;
+  inginxHeader *header;
+  char *base;
+  uint32_t end, idx;
+  c->state = INGINX_CLIENT_STATE_HEADER_COMPLETE;
+  m->status = parser->status_code;
+  m->method = parser->method;
+  m->major = parser->http_major;
+  m->minor = parser->http_minor;
+  if (c->server->limits[REQUEST_LIMIT_BODY] && !(parser->flags & F_CHUNKED) &&
+      parser->content_length != ULLONG_MAX && parser->content_length > (uint64_t) c->server->limits[REQUEST_LIMIT_BODY]) {
+    /* Refused before any of the body is read. */
+    return clientReject(c, 413);
+  }
+  if (!c->server->streaming && !(parser->flags & F_CHUNKED) &&
+      parser->content_length != ULLONG_MAX && parser->content_length > 0) {
+    /* Reserve the announced body at once, without a limit only so much. */
+    m->body = sdsMakeRoomForNonGreedy(sdsempty(), parser->content_length < PROTO_BODY_RESERVE_MAX ||
+        c->server->limits[REQUEST_LIMIT_BODY] ? parser->content_length : PROTO_BODY_RESERVE_MAX);
+  }
+  clientArmReadTimeout(c, CLIENT_TIMEOUT_BODY);
+  if (c->messageStart < 0) {
+    return 0;
+  }
+  base = c->input + c->messageStart;
+  m->headLength = terminateSlice(base, &m->url);
+  for (idx = 0; idx < (uint32_t) m->headerCount; ++idx) {
+    header = m->headers + idx;
+    end = terminateSlice(base, &header->name);
+    if (header->value.length == 0) {
+      /* Empty values are never reported, point to the terminator. */
+      header->value.offset = end - 1;
+    } else {
+      end = terminateSlice(base, &header->value);
+    }
+    if (end > m->headLength) {
+      m->headLength = end;
+    }
+  }
+  messageIndexHeaders(m, base);
+  return 0;
+}
 
 static int onBody(http_parser *parser, const char *at, size_t length)
 {
   inginxClient *c = parser->data;
+  c->state = INGINX_CLIENT_STATE_BODY;
+  c->bodyLength += length;
+  if (c->server->limits[REQUEST_LIMIT_BODY] && c->bodyLength > (uint64_t) c->server->limits[REQUEST_LIMIT_BODY]) {
+    /* Chunked bodies are only known as they come. */
+    return clientReject(c, 413);
+  }
+  clientArmReadTimeout(c, CLIENT_TIMEOUT_BODY);
+  if (c->server->streaming) {
+    /* The chunk is dropped from the input once parsed, the head stays in
+     * front of it and may have moved since the last one. */
+    c->message.base = c->messageStart >= 0 ? c->input + c->messageStart : NULL;
+    inginxServerClientBodyChunk(c->server, c, at, length);
+    return 0;
+  }
   if (c->message.body == NULL) {
     c->message.body = sdsnewlen(at, length);
+  } else if (sdsavail(c->message.body) >= length && at == c->message.body + sdslen(c->message.body)) {
+    /* Read in place, see clientBodyRoom(). */
+    sdsIncrLen(c->message.body, length);
   } else {
     c->message.body = sdscatlen(c->message.body, at, length);
   }
-  c->state = INGINX_CLIENT_STATE_BODY;
   return 0;
 }
 
 static int onMessageComplete(http_parser *parser)
 {
   inginxClient *c = parser->data;
-  c->message.status = parser->status_code;
-  c->message.method = parser->method;
-  c->message.major = parser->http_major;
-  c->message.minor = parser->http_minor;
+  c->message.base = c->messageStart >= 0 ? c->input + c->messageStart : NULL;
   c->state = INGINX_CLIENT_STATE_COMPLETE;
   c->lengthSent = 0;
   inginxServerClientRequest(c->server, c);
+  if (c->deferred) {
+    /* Responses go out in request order, hold pipelined requests back. */
+    http_parser_pause(parser, 1);
+  }
+  clientArmReadTimeout(c, c->deferred || (c->flags & CLIENT_READ_PAUSED) ? CLIENT_TIMEOUT_NONE : CLIENT_TIMEOUT_IDLE);
   c->state = INGINX_CLIENT_STATE_BEGIN;
+  c->messageStart = -1;
   resetMessage(&c->message);
-  if (c->field) {
-    sdsfree(c->field);
-    c->field = NULL;
-  }
-  if (c->value) {
-    sdsfree(c->value);
-    c->value = NULL;
-  }
   return 0;
 }
 
@@ -681,38 +1675,46 @@ static int onChunkComplete(http_parser *parser)
 
 static void resetMessage(inginxMessage *message)
 {
-  listIter *li;
-  listNode *ln;
-  if (message->urlDecoded != NULL) {
-    if (message->urlDecoded != message->url) {
-      sdsfree(message->urlDecoded);
-    }
-    message->urlDecoded = NULL;
+  if (message->owned) {
+    zfree(message->owned);
+    message->owned = NULL;
   }
-  if (message->url) {
-    sdsfree(message->url);
-    message->url = NULL;
-  }
-  if (message->parameter) {
-    sdsfree(message->parameter);
-    message->parameter = NULL;
-  }
-  li = listGetIterator(message->headers, AL_START_HEAD);
-  while ((ln = listNext(li)) != NULL) {
-    sdsfree(listNodeValue(ln));
-    listDelNode(message->headers, ln);
-  }
-  listReleaseIterator(li);
   if (message->body) {
     sdsfree(message->body);
     message->body = NULL;
   }
-  if (message->queryString) {
-    message->queryString = NULL;
-  }
-  if (message->parameterCursor) {
-    message->parameterCursor = NULL;
+  /* The header table, index and query tables are kept for the next request. */
+  message->headerCount = 0;
+  message->queryIndexed = 0;
+  message->parameterCount = 0;
+  memset(message->known, 0, sizeof(message->known));
+  message->indexSlots = 0;
+  message->headLength = 0;
+  message->url.offset = message->url.length = 0;
+  message->base = NULL;
+  message->urlDecoded = NULL;
+  message->urlDecodedLength = 0;
+  message->route = NULL;
+  message->routeValueCount = 0;
+}
+
+/* Free what resetMessage() keeps for the next request. */
+static void messageFreeTables(inginxMessage *message)
+{
+  zfree(message->headers);
+  zfree(message->index);
+  zfree(message->query);
+  zfree(message->parameters);
+  zfree(message->decoded);
+}
+
+/* Move the fields pointing into the head of a message along with it. */
+static const char *rebase(const char *ptr, const char *from, size_t length, const char *to)
+{
+  if (ptr >= from && ptr <= from + length) {
+    return to + (ptr - from);
   }
+  return ptr;
 }
 
 void inginxClientClose(inginxClient *c)
@@ -720,9 +1722,179 @@ void inginxClientClose(inginxClient *c)
   c->flags |= CLIENT_CLOSE_AFTER_REPLY;
 }
 
+/* Read and parse again once nothing holds the input back anymore: neither a
+ * deferred request nor inginxClientPauseReading(). */
+static void clientProceed(inginxClient *c)
+{
+  if (c->deferred || (c->flags & CLIENT_READ_PAUSED)) {
+    return;
+  }
+  http_parser_pause(&c->parser, 0);
+  if (c->state == INGINX_CLIENT_STATE_BEGIN) {
+    clientArmReadTimeout(c, c->messageStart < 0 ? CLIENT_TIMEOUT_IDLE : CLIENT_TIMEOUT_HEADER);
+  } else {
+    clientArmReadTimeout(c, c->state < INGINX_CLIENT_STATE_HEADER_COMPLETE ? CLIENT_TIMEOUT_HEADER : CLIENT_TIMEOUT_BODY);
+  }
+  if (clientStartReading(c) == C_ERR) {
+    inginxClientFreeAsync(c);
+    return;
+  }
+  /* Resumed from a listener the running parser just goes on. */
+  if (!(c->flags & CLIENT_PARSING) && c->inputParsed < c->inputLength) {
+    processInputBuffer(c);
+  }
+}
+
+/* Detach the deferred request from the client and process the input that
+ * was held back meanwhile. */
+static void clientResume(inginxClient *c)
+{
+  c->deferred->client = NULL;
+  c->deferred = NULL;
+  clientProceed(c);
+}
+
+void inginxClientPauseReading(inginxClient *c)
+{
+  if (c->flags & CLIENT_READ_PAUSED) {
+    return;
+  }
+  c->flags |= CLIENT_READ_PAUSED;
+  /* Stops a running parser right after the current callback. */
+  http_parser_pause(&c->parser, 1);
+  clientArmReadTimeout(c, CLIENT_TIMEOUT_NONE);
+  clientStopReading(c);
+}
+
+void inginxClientResumeReading(inginxClient *c)
+{
+  if (!(c->flags & CLIENT_READ_PAUSED)) {
+    return;
+  }
+  c->flags &= ~CLIENT_READ_PAUSED;
+  clientProceed(c);
+}
+
+inginxRequest *inginxClientDefer(inginxClient *c)
+{
+  inginxRequest *r;
+  if (c->state != INGINX_CLIENT_STATE_COMPLETE || c->deferred != NULL) {
+    return NULL;
+  }
+  r = zcalloc(sizeof(inginxRequest));
+  r->refs = 1;
+  r->server = c->server;
+  r->client = c;
+  r->message = c->message;
+  if (c->message.base != NULL) {
+    /* The input buffer of the client is reused, the request keeps a copy. */
+    r->message.owned = zmalloc(c->message.headLength);
+    memcpy(r->message.owned, c->message.base, c->message.headLength);
+    r->message.base = r->message.owned;
+    r->message.urlDecoded = rebase(r->message.urlDecoded, c->message.base, c->message.headLength, r->message.base);
+  }
+  memset(&c->message, 0, sizeof(inginxMessage));
+  c->message.major = r->message.major;
+  c->message.minor = r->message.minor;
+  c->deferred = r;
+  return r;
+}
+
+inginxMessage *inginxRequestMessage(inginxRequest *r)
+{
+  return &r->message;
+}
+
+inginxRequest *inginxRequestRetain(inginxRequest *r)
+{
+  __atomic_add_fetch(&r->refs, 1, __ATOMIC_RELAXED);
+  return r;
+}
+
+/* Runs on the event loop once the last reference is gone. */
+static void requestFree(aeEventLoop *el, void *privdata)
+{
+  inginxRequest *r = privdata;
+  inginxClient *c = r->client;
+  if (c != NULL) {
+    /* Nothing after it will be answered, the connection is closed. */
+    INGINX_LOG_WARN(r->server, "Deferred request released without response");
+    inginxClientSendError(c, 500);
+    inginxClientAddBodySize(c, NULL, 0);
+    inginxClientClose(c);
+    c->deferred = NULL;
+  }
+  resetMessage(&r->message);
+  messageFreeTables(&r->message);
+  zfree(r);
+}
+
+void inginxRequestRelease(inginxRequest *r)
+{
+  if (__atomic_sub_fetch(&r->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+    /* The client may only be touched from its own event loop. */
+    aePost(r->server->el, requestFree, r);
+  }
+}
+
+static void requestCompleted(aeEventLoop *el, void *privdata)
+{
+  inginxRequest *r = privdata;
+  inginxClient *c = r->client;
+  r->completion(r->server, c, &r->message, r->opaque);
+  if (c != NULL) {
+    clientResume(c);
+  }
+  if (__atomic_sub_fetch(&r->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+    requestFree(el, r);
+  }
+}
+
+int32_t inginxRequestComplete(inginxRequest *r, inginxRequestCompletion completion, void *opaque)
+{
+  if (r == NULL || completion == NULL) {
+    return C_ERR;
+  }
+  r->completion = completion;
+  r->opaque = opaque;
+  aePost(r->server->el, requestCompleted, r);
+  return C_OK;
+}
+
+int32_t inginxClientOffload(inginxClient *c, inginxOffloadWork work, inginxRequestCompletion completion, void *opaque)
+{
+  inginxServer *s = c->server;
+  inginxRequest *r;
+  if (work == NULL || completion == NULL) {
+    return C_ERR;
+  }
+  if (s->offload == NULL) {
+    work(&c->message, opaque);
+    completion(s, c, &c->message, opaque);
+    return C_OK;
+  }
+  if ((r = inginxClientDefer(c)) == NULL) {
+    return C_ERR;
+  }
+  r->work = work;
+  r->completion = completion;
+  r->opaque = opaque;
+  if (inginxOffloadPoolSubmit(s->offload, r) == C_OK) {
+    return C_OK;
+  }
+  /* Saturated, answer right away instead of queueing without bound. */
+  INGINX_LOG_DEBUG(s, "Offload queue is full, rejecting request");
+  c->deferred = NULL;
+  r->client = NULL;
+  inginxRequestRelease(r);
+  inginxClientSendError(c, 503);
+  inginxClientAddBodySize(c, NULL, 0);
+  return C_ERR;
+}
+
 void inginxClientSetStatus(inginxClient *c, int32_t status)
 {
-  addReply(c, sdscatprintf(sdsempty(), "HTTP/%u.%u %d %s\r\n", c->message.major, c->message.minor, status, httpCodeDesc(status)));
+  clientAddReplyPrintf(c, "HTTP/%u.%u %d %s\r\n", c->message.major, c->message.minor, status, httpCodeDesc(status));
 }
 
 void inginxClientSendError(inginxClient *c, int32_t code)
@@ -732,15 +1904,24 @@ void inginxClientSendError(inginxClient *c, int32_t code)
 
 void inginxClientSendRedirect(inginxClient *c, const char *location)
 {
-  addReply(c, sdscatprintf(sdsempty(), "HTTP/1.1 302\r\nLocation: %s\r\nContent-Length: 0\r\n", location));
+  clientAddReplyPrintf(c, "HTTP/1.1 302\r\nLocation: %s\r\nContent-Length: 0\r\n", location);
 }
 
 void inginxClientAddHeader(inginxClient *c, const char *name, const char *value)
 {
+  size_t nameLength = strlen(name), valueLength = strlen(value), available;
+  char *room;
   if (strcasecmp(name, "Content-Length") == 0) {
     c->lengthSent = 1;
   }
-  addReply(c, sdscatprintf(sdsempty(), "%s: %s\r\n", name, value));
+  if ((room = clientReserveReply(c, nameLength + valueLength + 4, &available)) == NULL) {
+    return;
+  }
+  memcpy(room, name, nameLength);
+  memcpy(room + nameLength, ": ", 2);
+  memcpy(room + nameLength + 2, value, valueLength);
+  memcpy(room + nameLength + 2 + valueLength, "\r\n", 2);
+  clientCommitReply(c, nameLength + valueLength + 4);
 }
 
 void inginxClientAddDateHeader(inginxClient *c, const char *name, int64_t date)
@@ -755,7 +1936,7 @@ void inginxClientAddDateHeader(inginxClient *c, const char *name, int64_t date)
   }
   localtime_r(&time, &tm);
   strftime(buffer, sizeof(buffer), "%a, %d %b %G %T %Z", &tm);
-  addReply(c, sdscatprintf(sdsempty(), "%s : %s\r\n", name, buffer));
+  clientAddReplyPrintf(c, "%s : %s\r\n", name, buffer);
 }
 
 void inginxClientAddReply(inginxClient *c, const char *body)
@@ -765,7 +1946,17 @@ void inginxClientAddReply(inginxClient *c, const char *body)
 
 void inginxClientAddReplySize(inginxClient *c, const void *body, size_t size)
 {
-  addReply(c, sdsnewlen(body, size));
+  clientAddReplyData(c, body, size);
+}
+
+char *inginxClientReserve(inginxClient *c, size_t size, size_t *available)
+{
+  return clientReserveReply(c, size, available);
+}
+
+void inginxClientCommit(inginxClient *c, size_t length)
+{
+  clientCommitReply(c, length);
 }
 
 void inginxClientAddBody(inginxClient *c, const char *body)
@@ -778,31 +1969,86 @@ void inginxClientAddBodySize(inginxClient *c, const void *body, size_t size)
 {
   if (body != NULL) {
     if (!c->lengthSent) {
-      addReply(c, sdscatprintf(sdsempty(), "Content-Length: %zd\r\n\r\n", size));
+      clientAddReplyPrintf(c, "Content-Length: %zu\r\n\r\n", size);
       c->lengthSent = 1;
     }
-    addReply(c, sdsnewlen(body, size));
+    clientAddReplyData(c, body, size);
   } else {
     if (!c->lengthSent) {
-      addReply(c, sdscatprintf(sdsempty(), "Content-Length: 0\r\n\r\n"));
+      clientAddReplyData(c, "Content-Length: 0\r\n\r\n", 21);
       c->lengthSent = 1;
     }
   }
 }
 
-void inginxClientAddBodyVPrintf(inginxClient *c, const char *fmt, va_list args)
+int32_t inginxClientSendFile(inginxClient *c, int fd, int64_t offset, size_t length)
+{
+  return inginxClientSendFileRelease(c, fd, offset, length, NULL, NULL);
+}
+
+int32_t inginxClientSendFileRelease(inginxClient *c, int fd, int64_t offset, size_t length, inginxFileRelease release, void *opaque)
 {
-  sds body = sdscatvprintf(sdsempty(), fmt, args);
+  inginxReplyFile *file;
+  if (length == 0 || prepareClientToWrite(c) != C_OK || (c->flags & CLIENT_CLOSE_AFTER_REPLY)) {
+    if (release) {
+      release(c->server, fd, opaque);
+    } else {
+      close(fd);
+    }
+    if (length == 0) {
+      inginxClientAddBodySize(c, NULL, 0);
+      return C_OK;
+    }
+    return C_ERR;
+  }
   if (!c->lengthSent) {
-    addReply(c, sdscatprintf(sdsempty(), "Content-Length: %zd\r\n\r\n", sdslen(body)));
+    clientAddReplyPrintf(c, "Content-Length: %zu\r\n\r\n", length);
     c->lengthSent = 1;
   }
-  addReply(c, body);
+  file = zmalloc(sizeof(inginxReplyFile));
+  file->fd = fd;
+  file->offset = offset;
+  file->length = length;
+  file->release = release;
+  file->opaque = opaque;
+  file->next = NULL;
+  if (c->filesTail) {
+    c->filesTail->next = file;
+  } else {
+    c->files = file;
+  }
+  c->filesTail = file;
+  listAddNodeTail(c->reply, file);
+  return C_OK;
+}
+
+void inginxClientAddBodyVPrintf(inginxClient *c, const char *fmt, va_list args)
+{
+  char header[64], *room;
+  size_t length;
+  int headerLength;
+  if (c->lengthSent) {
+    inginxClientAddReplyVPrintf(c, fmt, args);
+    return;
+  }
+  /* The body is formatted past room for the header, which then moves it
+   * right behind once its length is known. */
+  if ((room = clientReserveVPrintf(c, sizeof(header), 0, &length, fmt, args)) == NULL) {
+    return;
+  }
+  headerLength = snprintf(header, sizeof(header), "Content-Length: %zu\r\n\r\n", length);
+  memcpy(room, header, headerLength);
+  memmove(room + headerLength, room + sizeof(header), length);
+  clientCommitReply(c, headerLength + length);
+  c->lengthSent = 1;
 }
 
 void inginxClientAddReplyVPrintf(inginxClient *c, const char *fmt, va_list args)
 {
-  addReply(c, sdscatvprintf(sdsempty(), fmt, args));
+  size_t length;
+  if (clientReserveVPrintf(c, 0, 0, &length, fmt, args) != NULL) {
+    clientCommitReply(c, length);
+  }
 }
 
 void inginxClientAddBodyPrintf(inginxClient *c, const char *fmt, ...)
@@ -843,79 +2089,118 @@ inginxMethod inginxMessageMethod(const inginxMessage *message)
 
 const char* inginxMessageUrl(const inginxMessage *message)
 {
-  return message->url;
+  return message->base != NULL ? message->base + message->url.offset : NULL;
 }
 
-static void inginxMessageDecodeUrl(inginxMessage *message)
+static inline int hexValue(unsigned char chr)
 {
-#define CHECK_DECODED                   \
-  if (decoded == NULL) {                \
-    decoded = sdsnewlen(src, idx);      \
-  }
-#define H2I(x) (isdigit(x) ? x - '0' : x - 'W')
-  int32_t len = sdslen(message->url);
-  const char *src = message->url;
-  char chr, dst;
-  int32_t idx, hi, lo;
-  int32_t queryString = 0;
-  sds decoded = NULL;
-  for (idx = 0; idx < len; idx++) {
-    switch ((chr = src[idx])) {
-      case '%':
-        if (idx < len - 2 && isxdigit((hi = src[idx + 1])) && isxdigit((lo = src[idx + 2]))) {
-          hi = tolower(hi), lo = tolower(lo);
-          CHECK_DECODED
-          dst = (char) ((H2I(hi) << 4) | H2I(lo));
-          idx += 2;
-          decoded = sdscatlen(decoded, &dst, 1);
-        } else {
-          if (decoded != NULL) {
-            sdsfree(decoded);
-            decoded = NULL;
-          }
-          message->queryString = NULL;
-          return;
-        }
+  if ((unsigned) (chr - '0') < 10) {
+    return chr - '0';
+  }
+  chr |= 0x20;
+  if ((unsigned) (chr - 'a') < 6) {
+    return chr - 'a' + 10;
+  }
+  return -1;
+}
+
+/* The first '%' from src on, or '+' too if plus, end if there is none. */
+static const char *findEscape(const char *src, const char *end, int plus)
+{
+#if defined(__GNUC__) && defined(__SSE2__)
+  const __m128i percent = _mm_set1_epi8('%');
+  const __m128i other = _mm_set1_epi8(plus ? '+' : '%');
+  __m128i chunk;
+  int mask;
+  for (; end - src >= 16; src += 16) {
+    chunk = _mm_loadu_si128((const __m128i *) src);
+    mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, percent), _mm_cmpeq_epi8(chunk, other)));
+    if (mask) {
+      return src + __builtin_ctz(mask);
+    }
+  }
+#endif
+  for (; src < end; ++src) {
+    if (*src == '%' || (plus && *src == '+')) {
+      return src;
+    }
+  }
+  return end;
+}
+
+/* Decode length bytes of src into dst, which may be src itself, '+' being a
+ * space if plus. Runs without escapes are copied at once. Returns the decoded
+ * length, -1 on a malformed escape if strict, it's kept as is otherwise. */
+static ssize_t decodeEscapes(char *dst, const char *src, size_t length, int plus, int strict)
+{
+  const char *end = src + length, *run;
+  char *out = dst;
+  int hi, lo;
+  while (src < end) {
+    if (*src != '%' && (!plus || *src != '+')) {
+      run = findEscape(src, end, plus);
+      if (out != src) {
+        memmove(out, src, run - src);
+      }
+      out += run - src;
+      if ((src = run) == end) {
         break;
-      case '+':
-        if (queryString) {
-          CHECK_DECODED
-          dst = ' ';
-          decoded = sdscatlen(decoded, &dst, 1);
-          break;
-        }
-        goto appendDecoded;
-      case '?':
-        if (!queryString) {
-          queryString = 1;
-          message->queryString = (const char *)(decoded != NULL ? sdslen(decoded) : idx);
-        }
-        /* FALL THROUGH */
-      default:
-appendDecoded:
-        if (decoded != NULL) {
-          decoded = sdscatlen(decoded, src + idx, 1);
-        }
+      }
+    }
+    if (*src == '+') {
+      *out++ = ' ';
+      src++;
+    } else if (end - src > 2 && (hi = hexValue(src[1])) >= 0 && (lo = hexValue(src[2])) >= 0) {
+      *out++ = (char) (hi << 4 | lo);
+      src += 3;
+    } else if (strict) {
+      return -1;
+    } else {
+      *out++ = *src++;
     }
   }
-  if (decoded == NULL) {
-    message->urlDecoded = message->url;
-  } else {
-    message->urlDecoded = decoded;
+  return out - dst;
+}
+
+/* The path and the query string are decoded apart, '+' is only a space in
+ * the latter. An url without escapes is used as is, otherwise it's decoded
+ * once into a buffer kept by the message, never longer than the url. A
+ * malformed escape leaves the decoded url NULL. */
+static void inginxMessageDecodeUrl(inginxMessage *message)
+{
+  const char *url = inginxMessageUrl(message), *end = url + message->url.length, *query;
+  ssize_t path, rest = 0;
+  if ((query = memchr(url, '?', message->url.length)) == NULL) {
+    query = end;
   }
-  if (queryString) {
-    message->queryString = message->urlDecoded + (uintptr_t) (message->queryString) + 1;
-  } else {
-    message->queryString = NULL;
+  if (findEscape(url, query, 0) == query && (query == end || findEscape(query, end, 1) == end)) {
+    message->urlDecoded = url;
+    message->urlDecodedLength = message->url.length;
+    return;
+  }
+  if (message->decodedCapacity < message->url.length + 1) {
+    zfree(message->decoded);
+    message->decodedCapacity = message->url.length + 1;
+    message->decoded = zmalloc(message->decodedCapacity);
+  }
+  if ((path = decodeEscapes(message->decoded, url, query - url, 0, 1)) < 0) {
+    return;
+  }
+  if (query != end) {
+    message->decoded[path] = '?';
+    if ((rest = decodeEscapes(message->decoded + path + 1, query + 1, end - query - 1, 1, 1)) < 0) {
+      return;
+    }
+    rest++;
   }
-#undef CHECK_DECODED
-#undef H2I
-  return;
+  message->decoded[path + rest] = '\0';
+  message->urlDecoded = message->decoded;
+  message->urlDecodedLength = path + rest;
 }
 
 const char *inginxMessageUrlDecoded(const inginxMessage *message)
 {
-  if (message->urlDecoded == NULL) {
+  if (message->urlDecoded == NULL && message->base != NULL) {
     inginxMessageDecodeUrl((inginxMessage *) message);
   }
   return message->urlDecoded;
@@ -928,29 +2213,33 @@ const char *inginxMessageHeader(const inginxMessage *message, const char *field)
 
 const char *inginxMessageHeaderNext(const inginxMessage *message, const char *field, const char *cursor)
 {
-  listIter *li;
-  listNode *ln, *ln2;
-  sds value = NULL;
-  if (message->headers == NULL) {
+  return messageHeaderValue(message, messageFindHeader(message, field), cursor);
+}
+
+const char *inginxMessageHeaderById(const inginxMessage *message, inginxHeaderId id)
+{
+  return inginxMessageHeaderByIdNext(message, id, NULL);
+}
+
+const char *inginxMessageHeaderByIdNext(const inginxMessage *message, inginxHeaderId id, const char *cursor)
+{
+  if (id <= INGINX_HEADER_UNKNOWN || id >= INGINX_HEADER_COUNT) {
     return NULL;
   }
-  li = listGetIterator(message->headers, AL_START_HEAD);
-  while ((ln = listNext(li)) != NULL) {
-    ln2 = listNext(li);
-    if (strcasecmp(listNodeValue(ln), field) == 0) {
-      value = listNodeValue(ln2);
-      if (cursor != NULL) {
-        if (value == cursor) {
-          cursor = NULL;
-        }
-        value = NULL;
-        continue;
-      }
-      break;
-    }
+  return messageHeaderValue(message, message->known[id], cursor);
+}
+
+inginxHeaderId inginxHeaderLookup(const char *field)
+{
+  return headerIdOf(field, headerHash(field));
+}
+
+const char *inginxHeaderName(inginxHeaderId id)
+{
+  if (id <= INGINX_HEADER_UNKNOWN || id >= INGINX_HEADER_COUNT) {
+    return NULL;
   }
-  listReleaseIterator(li);
-  return value;
+  return headerNames[id];
 }
 
 const char *inginxMessageBody(const inginxMessage *message)
@@ -965,10 +2254,18 @@ size_t inginxMessageBodyLength(const inginxMessage *message)
 
 void inginxClientAddHeaderVPrintf(inginxClient *c, const char *name, const char *fmt, va_list args)
 {
+  size_t nameLength = strlen(name), length;
+  char *room;
   if (strcasecmp(name, "Content-Length") == 0) {
     c->lengthSent = 1;
   }
-  addReply(c, sdscat(sdscatvprintf(sdscatprintf(sdsempty(), "%s: ", name), fmt, args), "\r\n"));
+  if ((room = clientReserveVPrintf(c, nameLength + 2, 2, &length, fmt, args)) == NULL) {
+    return;
+  }
+  memcpy(room, name, nameLength);
+  memcpy(room + nameLength, ": ", 2);
+  memcpy(room + nameLength + 2 + length, "\r\n", 2);
+  clientCommitReply(c, nameLength + length + 4);
 }
 
 void inginxClientAddHeaderPrintf(inginxClient *c, const char *name, const char *fmt, ...)
@@ -1006,50 +2303,153 @@ inginxClient *inginxClientConnect(inginxServer *server, const char *url, inginxM
   return NULL;
 }
 
-const char *inginxMessageParameter(const inginxMessage *message, const char *name)
+/* Decode a name or value of the query string in place and NUL terminate it,
+ * return its decoded length. Malformed escapes are kept as they are. */
+static uint32_t decodeQueryComponent(char *component, uint32_t length)
 {
-  return inginxMessageParameterNext(message, name, NULL);
+  length = decodeEscapes(component, component, length, 1, 0);
+  component[length] = '\0';
+  return length;
 }
 
-const char *inginxMessageParameterNext(const inginxMessage *constMessage, const char *name, const char *cursor)
+/* Split the query string once into parameters. It's copied so that names and
+ * values can be decoded and terminated in place over the '=' and '&' following
+ * them: what is returned stays where it is until the message is reset. */
+static void messageIndexQuery(inginxMessage *m)
 {
-  size_t nameLen;
-  inginxMessage *message = (inginxMessage *) constMessage;
-  const char *pos, *stop, *end;
-  const char *url = inginxMessageUrlDecoded(message);
-  if (url == NULL) {
+  const char *url = inginxMessageUrl(m), *query, *end;
+  inginxParameter *parameter;
+  uint32_t length, pos, next, equal;
+  char *found;
+  m->queryIndexed = 1;
+  m->parameterCount = 0;
+  if (url == NULL || (query = memchr(url, '?', m->url.length)) == NULL) {
+    return;
+  }
+  query++;
+  if ((end = memchr(query, '#', url + m->url.length - query)) == NULL) {
+    end = url + m->url.length;
+  }
+  length = end - query;
+  if (length + 1 > m->queryCapacity) {
+    zfree(m->query);
+    m->queryCapacity = length + 1;
+    m->query = zmalloc(m->queryCapacity);
+  }
+  memcpy(m->query, query, length);
+  m->query[length] = '\0';
+  for (pos = 0; pos < length; pos = next + 1) {
+    found = memchr(m->query + pos, '&', length - pos);
+    next = found ? (uint32_t) (found - m->query) : length;
+    if (next == pos) {
+      continue;
+    }
+    found = memchr(m->query + pos, '=', next - pos);
+    equal = found ? (uint32_t) (found - m->query) : next;
+    if (m->parameterCount == m->parameterCapacity) {
+      m->parameterCapacity = m->parameterCapacity ? m->parameterCapacity * 2 : 16;
+      m->parameters = zrealloc(m->parameters, sizeof(inginxParameter) * m->parameterCapacity);
+    }
+    parameter = m->parameters + m->parameterCount++;
+    parameter->name.offset = pos;
+    parameter->name.length = decodeQueryComponent(m->query + pos, equal - pos);
+    if (equal < next) {
+      parameter->value.offset = equal + 1;
+      parameter->value.length = next - equal - 1;
+      parameter->decoded = 0;
+    } else {
+      /* Without a value, point to the terminator of the name. */
+      parameter->value.offset = pos + parameter->name.length;
+      parameter->value.length = 0;
+      parameter->decoded = 1;
+    }
+  }
+}
+
+static inginxMessage *messageQuery(const inginxMessage *message)
+{
+  inginxMessage *m = (inginxMessage *) message;
+  if (!m->queryIndexed) {
+    messageIndexQuery(m);
+  }
+  return m;
+}
+
+int32_t inginxMessageParameterCount(const inginxMessage *message)
+{
+  return messageQuery(message)->parameterCount;
+}
+
+const char *inginxMessageParameterName(const inginxMessage *message, int32_t index)
+{
+  inginxMessage *m = messageQuery(message);
+  if (index < 0 || index >= m->parameterCount) {
     return NULL;
   }
-  end = url + sdslen((char *) url);
-  if (message->queryString == NULL || message->queryString + 1 == end) {
+  return m->query + m->parameters[index].name.offset;
+}
+
+const char *inginxMessageParameterValue(const inginxMessage *message, int32_t index)
+{
+  inginxMessage *m = messageQuery(message);
+  inginxParameter *parameter;
+  if (index < 0 || index >= m->parameterCount) {
     return NULL;
   }
+  parameter = m->parameters + index;
+  if (!parameter->decoded) {
+    parameter->value.length = decodeQueryComponent(m->query + parameter->value.offset, parameter->value.length);
+    parameter->decoded = 1;
+  }
+  return m->query + parameter->value.offset;
+}
 
-  if (cursor == NULL) {
-    cursor = message->queryString;
-  } else {
-    cursor = message->parameterCursor;
+int32_t inginxMessageParameterFind(const inginxMessage *message, const char *name, int32_t from)
+{
+  inginxMessage *m = messageQuery(message);
+  inginxParameter *parameter;
+  size_t length = strlen(name);
+  int32_t idx;
+  for (idx = from > 0 ? from : 0; idx < m->parameterCount; ++idx) {
+    parameter = m->parameters + idx;
+    if (parameter->name.length == length && strcasecmp(m->query + parameter->name.offset, name) == 0) {
+      return idx;
+    }
   }
+  return -1;
+}
 
-  nameLen = strlen(name);
+const char *inginxMessageParameter(const inginxMessage *message, const char *name)
+{
+  return inginxMessageParameterNext(message, name, NULL);
+}
 
-  for (pos = cursor; pos + nameLen < end; pos++) {
-    if ((pos == cursor || pos[-1] == '&') && pos[nameLen] == '=' && strncasecmp(name, pos, nameLen) == 0) {
-      pos += nameLen + 1;
-      stop = (const char *) memchr(pos, '&', (size_t)(end - pos));
-      if (stop == NULL) {
-        stop = end;
-      }
-      nameLen = stop - pos;
-      if (message->parameter == NULL) {
-        message->parameter = sdsnewlen(pos, nameLen);
+const char *inginxMessageParameterNext(const inginxMessage *message, const char *name, const char *cursor)
+{
+  inginxMessage *m = messageQuery(message);
+  int32_t low = 0, high = m->parameterCount - 1, middle, from = 0;
+  uint32_t offset;
+  if (cursor != NULL) {
+    /* Values are in query order, find the one returned last. */
+    if (cursor < m->query || cursor >= m->query + m->queryCapacity) {
+      return NULL;
+    }
+    offset = cursor - m->query;
+    from = -1;
+    while (low <= high) {
+      middle = low + (high - low) / 2;
+      if (m->parameters[middle].value.offset == offset) {
+        from = middle + 1;
+        break;
+      } else if (m->parameters[middle].value.offset < offset) {
+        low = middle + 1;
       } else {
-        message->parameter = sdscpylen(message->parameter, pos, nameLen);
+        high = middle - 1;
       }
-      message->parameterCursor = stop == end ? stop : stop + 1;
-      return message->parameter;
+    }
+    if (from < 0) {
+      return NULL;
     }
   }
-  message->parameterCursor = NULL;
-  return NULL;
+  return inginxMessageParameterValue(m, inginxMessageParameterFind(m, name, from));
 }
@@ -22,13 +22,41 @@ extern "C" {
                                         handler is yet not installed. */
 #define CLIENT_REPLY_OFF (1<<22)   /* Don't send replies to client. */
 #define CLIENT_REPLY_SKIP (1<<24)  /* Don't send just this reply. */
+#define CLIENT_SENDING (1<<25)     /* A completion based send is in flight. */
+#define CLIENT_READ_PAUSED (1<<26) /* Input is held back, see inginxClientPauseReading(). */
+#define CLIENT_PARSING (1<<27)     /* The parser is running on the input. */
+#define CLIENT_READ_STOPPED (1<<28) /* Nothing is read from the socket. */
 
 /* Protocol and I/O related defines */
 #define PROTO_IOBUF_LEN         (1024*16)  /* Generic I/O buffer size */
 #define PROTO_REPLY_CHUNK_BYTES (16*1024) /* 16k output buffer */
 #define PROTO_INLINE_MAX_SIZE   (1024*64) /* Max size of inline reads */
+#define PROTO_IOBUF_POOL_MAX    256        /* Max idle I/O buffers kept per worker */
+#define PROTO_READ_MIN_ROOM     (1024*4)   /* Grow the input buffer below this room */
+#define PROTO_READS_PER_EVENT   16         /* Max reads from a client per readable event */
+#define PROTO_WRITEV_MAX        1024       /* Max buffers gathered by a single writev, at most IOV_MAX */
+#define PROTO_BODY_DIRECT_MIN   (1024*16)  /* Read bodies with more left straight into place */
+#define PROTO_BODY_RESERVE_MAX  (1024*1024*16) /* Max body reserved ahead without a body limit */
+#define PROTO_SENDFILE_MAX      (1024*1024) /* Max file bytes sent by a single sendfile */
+#define CLIENT_POOL_MAX         1024       /* Max idle clients kept per worker */
+
+/* Timeouts */
+#define TIMEOUT_WHEEL_SLOTS      4096 /* Must be a power of two */
+#define TIMEOUT_WHEEL_RESOLUTION 32   /* Milliseconds covered by a slot */
+#define CLIENT_DEFAULT_HEADER_TIMEOUT (60*1000)
+#define CLIENT_DEFAULT_BODY_TIMEOUT   (60*1000)
+#define CLIENT_DEFAULT_IDLE_TIMEOUT   (75*1000)
+#define CLIENT_DEFAULT_WRITE_TIMEOUT  (60*1000)
 #define LONG_STR_SIZE      21          /* Bytes needed for long -> str + '\0' */
 
+/* Request limits */
+#define CLIENT_DEFAULT_MAX_URL          (8*1024)
+#define CLIENT_DEFAULT_MAX_HEADER_BYTES (32*1024)
+#define CLIENT_DEFAULT_MAX_HEADER_COUNT 100
+#define CLIENT_DEFAULT_MAX_BODY         (16*1024*1024)
+
+#define ROUTE_MAX_PARAMETERS 16 /* :param and * segments of a route pattern */
+
 typedef enum inginxClientState {
   INGINX_CLIENT_STATE_BEGIN = 0,
   INGINX_CLIENT_STATE_URL = 1,
@@ -42,47 +70,147 @@ typedef enum inginxClientState {
   INGINX_CLIENT_STATE_COMPLETE = 9,
 } inginxClientState;
 
+/* What the client is waiting for on the read side */
+typedef enum inginxClientTimeout {
+  CLIENT_TIMEOUT_NONE = 0,
+  CLIENT_TIMEOUT_IDLE = 1,   /* the next request of a keep-alive connection */
+  CLIENT_TIMEOUT_HEADER = 2, /* the end of the headers, since the request began */
+  CLIENT_TIMEOUT_BODY = 3,   /* more of the body */
+  CLIENT_TIMEOUT_WRITE = 4,  /* progress sending the reply, tracked apart */
+  CLIENT_TIMEOUT_COUNT = 5,
+} inginxClientTimeout;
+
+/* What a request may not exceed, rejected with the status in the comment */
+typedef enum inginxRequestLimit {
+  REQUEST_LIMIT_URL = 0,          /* bytes of the url, 414 */
+  REQUEST_LIMIT_HEADER_BYTES = 1, /* bytes of the head past the url, 431 */
+  REQUEST_LIMIT_HEADER_COUNT = 2, /* number of header lines, 431 */
+  REQUEST_LIMIT_BODY = 3,         /* bytes of the body, 413 */
+  REQUEST_LIMIT_COUNT = 4,
+} inginxRequestLimit;
+
+/* Bytes of the head of a request, relative to inginxMessage.base */
+typedef struct inginxSlice {
+  uint32_t offset;
+  uint32_t length;
+} inginxSlice;
+
+typedef struct inginxHeader {
+  inginxSlice name;
+  inginxSlice value;
+  int32_t next; /* 1 + index of the next header of the same name, 0 if last */
+} inginxHeader;
+
+/* A parameter of the query string, relative to inginxMessage.query */
+typedef struct inginxParameter {
+  inginxSlice name;  /* decoded while indexing */
+  inginxSlice value; /* raw until decoded on first use */
+  int32_t decoded;
+} inginxParameter;
+
 typedef struct inginxMessage {
   uint16_t status;
   uint8_t method;
-  uint8_t padding;
+  uint8_t queryIndexed; /* query and parameters below are valid */
   uint16_t major;
   uint16_t minor;
-  sds url;
-  sds urlDecoded;
-  sds parameter;
-  list *headers;
+  char *owned; /* copy of the head once detached from the client input */
+  inginxSlice url;
+  inginxHeader *headers; /* kept allocated across requests */
+  int32_t headerCount;
+  int32_t headerCapacity;
+  int32_t known[INGINX_HEADER_COUNT]; /* 1 + index of the first header of an id */
+  int32_t *index; /* open addressing table of the other names, kept allocated */
+  int32_t indexCapacity;
+  int32_t indexSlots; /* in use for this message, 0 if every name is well-known */
+  uint32_t headLength; /* bytes of the head to keep, terminators included */
+  char *query; /* copy of the query string, decoded in place, kept allocated */
+  uint32_t queryCapacity;
+  inginxParameter *parameters; /* kept allocated across requests */
+  int32_t parameterCount;
+  int32_t parameterCapacity;
+  char *decoded; /* url decoded if it has escapes, kept allocated */
+  uint32_t decodedCapacity;
   sds body;
   /* fields below doesn't own any resource and do not need to be freed */
-  const char *queryString;
-  const char *parameterCursor;
+  char *base; /* head of the request, url and headers are NUL terminated in place */
+  const char *urlDecoded;
+  size_t urlDecodedLength;
+  const struct inginxRoute *route; /* matched by the router, NULL if none */
+  inginxSlice routeValues[ROUTE_MAX_PARAMETERS]; /* parameters of the route, relative to base */
+  int32_t routeValueCount;
 } inginxMessage;
 
+/* A range of a file queued in the reply, see inginxClientSendFile(). The
+ * reply node holding it points to it, files are chained in reply order. */
+typedef struct inginxReplyFile {
+  int fd;
+  int64_t offset;
+  size_t length; /* bytes left to send */
+  inginxFileRelease release; /* fd is closed if NULL */
+  void *opaque;
+  struct inginxReplyFile *next;
+} inginxReplyFile;
+
+/* A request detached from the client to be answered later, see
+ * inginxClientDefer(). */
+typedef struct inginxRequest {
+  int32_t refs;
+  inginxServer *server;
+  inginxClient *client; /* NULL once the client is gone or answered */
+  inginxMessage message;
+  inginxRequestCompletion completion;
+  inginxOffloadWork work; /* run on the offload pool, see inginxClientOffload() */
+  void *opaque;
+} inginxRequest;
+
 typedef struct inginxClient {
   uint64_t id;
   int fd;
-  char buffer[PROTO_IOBUF_LEN];
+  char *buffer; /* PROTO_IOBUF_LEN bytes from the worker pool while replying */
   size_t position;
   size_t sent;
   list *reply;
   int32_t replyBytes;
+  inginxReplyFile *files;    /* file ranges queued in reply, in order */
+  inginxReplyFile *filesTail;
   int32_t flags;
   inginxServer *server;
-  int64_t lastInteraction;
+  listNode *clientNode;  /* node in server clients, NULL if not linked */
+  listNode pendingNode;  /* linked in server pending if CLIENT_PENDING_WRITE */
+  listNode *closingNode; /* node in server closing, if CLIENT_CLOSE_ASAP */
+  inginxClientTimeout readTimeout;
+  int64_t readDeadline;  /* ms, 0 while not armed */
+  int64_t writeDeadline; /* ms, 0 unless output is pending */
+  int64_t wheelDeadline; /* when the wheel looks at the client, 0 if not linked */
+  struct inginxClient *wheelPrev;
+  struct inginxClient *wheelNext;
   inginxClientState state;
   uint8_t lengthSent;
 
   /* http related */
   http_parser parser;
   inginxMessage message;
-  sds field;
-  sds value;
+  char *input;          /* received bytes, from the worker pool while reading */
+  size_t inputSize;
+  size_t inputLength;
+  size_t inputParsed;
+  ssize_t messageStart; /* offset of the request being parsed in input, -1 if none */
+  uint64_t bodyLength;  /* bytes of body parsed for the current request */
+  inginxRequest *deferred; /* request waiting for its response */
+  struct inginxClient *next; /* chains idle clients in the worker pool */
 } inginxClient;
 
 void inginxClientReadFrom(aeEventLoop *el, int fd, void *privdata, int mask);
+void inginxClientRecvFrom(aeEventLoop *el, int fd, void *privdata, const char *buf, long nread);
 int inginxClientsHandleWithPendingWrites(aeEventLoop *el);
 void inginxClientsFreeInAsyncFreeQueue(aeEventLoop *el);
+void inginxClientsHandleTimeouts(aeEventLoop *el);
+void inginxClientWaitRequest(inginxClient *c);
 void inginxClientFree(aeEventLoop *el, inginxClient *c);
+inginxClient *inginxClientAllocate(inginxServer *s);
+void inginxClientRecycle(inginxClient *c);
+void inginxClientsFreePools(inginxServer *s);
 
 inginxClient *inginxClientConnect(inginxServer *server, const char *url, inginxMethod method);
 
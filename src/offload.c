@@ -0,0 +1,91 @@
+#include <pthread.h>
+
+#include "server.h"
+#include "offload.h"
+#include "zmalloc.h"
+
+static void *offloadPoolMain(void *arg)
+{
+  inginxOffloadPool *pool = arg;
+  inginxRequest *r;
+  pthread_mutex_lock(&pool->lock);
+  while (1) {
+    while (pool->count == 0 && !pool->shutdown) {
+      pthread_cond_wait(&pool->ready, &pool->lock);
+    }
+    if (pool->count == 0) {
+      break;
+    }
+    r = pool->jobs[pool->head];
+    pool->head = (pool->head + 1) % pool->capacity;
+    pool->count--;
+    pthread_mutex_unlock(&pool->lock);
+
+    /* The reply is built by the completion, back on the loop of the client. */
+    r->work(&r->message, r->opaque);
+    inginxRequestComplete(r, r->completion, r->opaque);
+
+    pthread_mutex_lock(&pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+inginxOffloadPool *inginxOffloadPoolCreate(int32_t threads, int32_t depth)
+{
+  int32_t idx;
+  inginxOffloadPool *pool = zcalloc(sizeof(inginxOffloadPool));
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->ready, NULL);
+  pool->capacity = depth;
+  pool->jobs = zmalloc(sizeof(inginxRequest *) * depth);
+  pool->threads = zmalloc(sizeof(pthread_t) * threads);
+  for (idx = 0; idx < threads; ++idx) {
+    if (pthread_create(pool->threads + idx, NULL, offloadPoolMain, pool) != 0) {
+      break;
+    }
+  }
+  pool->size = idx;
+  if (pool->size == 0) {
+    inginxOffloadPoolFree(pool);
+    return NULL;
+  }
+  return pool;
+}
+
+int32_t inginxOffloadPoolSubmit(inginxOffloadPool *pool, inginxRequest *r)
+{
+  pthread_mutex_lock(&pool->lock);
+  if (pool->count == pool->capacity || pool->shutdown) {
+    pthread_mutex_unlock(&pool->lock);
+    return C_ERR;
+  }
+  pool->jobs[(pool->head + pool->count) % pool->capacity] = r;
+  pool->count++;
+  pthread_cond_signal(&pool->ready);
+  pthread_mutex_unlock(&pool->lock);
+  return C_OK;
+}
+
+void inginxOffloadPoolFree(inginxOffloadPool *pool)
+{
+  int32_t idx;
+  pthread_mutex_lock(&pool->lock);
+  pool->shutdown = 1;
+  /* Queued requests are not run anymore, their clients get a 500. */
+  while (pool->count > 0) {
+    inginxRequestRelease(pool->jobs[pool->head]);
+    pool->head = (pool->head + 1) % pool->capacity;
+    pool->count--;
+  }
+  pthread_cond_broadcast(&pool->ready);
+  pthread_mutex_unlock(&pool->lock);
+  for (idx = 0; idx < pool->size; ++idx) {
+    pthread_join(pool->threads[idx], NULL);
+  }
+  pthread_cond_destroy(&pool->ready);
+  pthread_mutex_destroy(&pool->lock);
+  zfree(pool->threads);
+  zfree(pool->jobs);
+  zfree(pool);
+}
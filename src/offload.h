@@ -0,0 +1,37 @@
+#ifndef __INGNIX_OFFLOAD_H__
+#define __INGNIX_OFFLOAD_H__
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "networking.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Bounded pool of threads running the blocking part of deferred requests,
+ * shared by every worker of a group. */
+typedef struct inginxOffloadPool {
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  pthread_t *threads;
+  int32_t size;
+  inginxRequest **jobs; /* ring of queued requests */
+  int32_t capacity;
+  int32_t head;
+  int32_t count;
+  int32_t shutdown;
+} inginxOffloadPool;
+
+inginxOffloadPool *inginxOffloadPoolCreate(int32_t threads, int32_t depth);
+/* Return C_ERR without taking the request when the queue is full. */
+int32_t inginxOffloadPoolSubmit(inginxOffloadPool *pool, inginxRequest *r);
+/* Stop the threads once running jobs are done, queued requests are released. */
+void inginxOffloadPoolFree(inginxOffloadPool *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __INGNIX_OFFLOAD_H__ */
@@ -0,0 +1,354 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "server.h"
+#include "router.h"
+#include "zmalloc.h"
+
+typedef struct routerSearch {
+  const char *path;
+  size_t length;
+  inginxMethod method;
+  inginxSlice *values;
+  int32_t count;
+  uint64_t allowed;
+} routerSearch;
+
+static inginxRouterNode *routerNodeCreate(const char *prefix, uint32_t length)
+{
+  inginxRouterNode *node = zcalloc(sizeof(inginxRouterNode));
+  if (length > 0) {
+    node->prefix = zmalloc(length);
+    memcpy(node->prefix, prefix, length);
+    node->prefixLength = length;
+  }
+  return node;
+}
+
+static void routerNodeFree(inginxRouterNode *node)
+{
+  inginxRoute *route, *next;
+  int32_t idx;
+  if (node == NULL) {
+    return;
+  }
+  for (idx = 0; idx < node->childCount; ++idx) {
+    routerNodeFree(node->children[idx]);
+  }
+  routerNodeFree(node->parameter);
+  routerNodeFree(node->wildcard);
+  for (route = node->routes; route != NULL; route = next) {
+    next = route->next;
+    for (idx = 0; idx < route->parameterCount; ++idx) {
+      zfree(route->names[idx]);
+    }
+    zfree(route);
+  }
+  zfree(node->children);
+  zfree(node->indices);
+  zfree(node->prefix);
+  zfree(node);
+}
+
+static void routerNodeAppend(inginxRouterNode *node, inginxRouterNode *child)
+{
+  node->children = zrealloc(node->children, sizeof(inginxRouterNode *) * (node->childCount + 1));
+  node->indices = zrealloc(node->indices, node->childCount + 1);
+  node->children[node->childCount] = child;
+  node->indices[node->childCount] = child->prefix[0];
+  node->childCount++;
+}
+
+/* The node reached from node by the static bytes, created or split off an
+ * existing child as needed. */
+static inginxRouterNode *routerInsertStatic(inginxRouterNode *node, const char *bytes, size_t length)
+{
+  inginxRouterNode *child, *split;
+  const char *found;
+  uint32_t common;
+  int32_t idx;
+  while (length > 0) {
+    if (node->childCount == 0 || (found = memchr(node->indices, bytes[0], node->childCount)) == NULL) {
+      child = routerNodeCreate(bytes, length);
+      routerNodeAppend(node, child);
+      return child;
+    }
+    idx = found - node->indices;
+    child = node->children[idx];
+    for (common = 1; common < child->prefixLength && common < length && child->prefix[common] == bytes[common]; ++common);
+    if (common < child->prefixLength) {
+      /* Keep the common part in a new node above the child. */
+      split = routerNodeCreate(child->prefix, common);
+      child->prefixLength -= common;
+      memmove(child->prefix, child->prefix + common, child->prefixLength);
+      routerNodeAppend(split, child);
+      node->children[idx] = split;
+      child = split;
+    }
+    node = child;
+    bytes += common;
+    length -= common;
+  }
+  return node;
+}
+
+inginxRouter *inginxRouterCreate(void)
+{
+  inginxRouter *router = zcalloc(sizeof(inginxRouter));
+  router->root = routerNodeCreate(NULL, 0);
+  return router;
+}
+
+int32_t inginxRouterAdd(inginxRouter *router, inginxMethod method, const char *pattern, inginxRouteHandler handler, void *opaque)
+{
+  inginxRouterNode *node = router->root;
+  inginxRoute *route;
+  const char *p, *segment;
+  size_t length;
+  int32_t count = 0;
+  if (pattern == NULL || pattern[0] != '/' || handler == NULL || (uint32_t) method >= 64) {
+    return C_ERR;
+  }
+  /* Parameters take whole segments, a wildcard the last one. */
+  for (segment = pattern + 1; ; segment = p + 1) {
+    p = segment + strcspn(segment, "/");
+    if (*segment == ':' || *segment == '*') {
+      if (++count > ROUTE_MAX_PARAMETERS || (*segment == ':' && p - segment == 1) || (*segment == '*' && *p != '\0')) {
+        return C_ERR;
+      }
+      segment++;
+    }
+    if (memchr(segment, ':', p - segment) != NULL || memchr(segment, '*', p - segment) != NULL) {
+      return C_ERR;
+    }
+    if (*p == '\0') {
+      break;
+    }
+  }
+
+  route = zcalloc(sizeof(inginxRoute));
+  route->method = method;
+  route->handler = handler;
+  route->opaque = opaque;
+  for (p = pattern; *p != '\0'; p += length) {
+    if (*p == ':' || *p == '*') {
+      length = strcspn(p, "/");
+      route->names[route->parameterCount] = zmalloc(length);
+      memcpy(route->names[route->parameterCount], p + 1, length - 1);
+      route->names[route->parameterCount++][length - 1] = '\0';
+      if (*p == ':') {
+        node = node->parameter != NULL ? node->parameter : (node->parameter = routerNodeCreate(NULL, 0));
+      } else {
+        node = node->wildcard != NULL ? node->wildcard : (node->wildcard = routerNodeCreate(NULL, 0));
+      }
+    } else {
+      length = strcspn(p, ":*");
+      node = routerInsertStatic(node, p, length);
+    }
+  }
+  if (node->methods & (1ULL << method)) {
+    for (count = 0; count < route->parameterCount; ++count) {
+      zfree(route->names[count]);
+    }
+    zfree(route);
+    return C_ERR;
+  }
+  route->next = node->routes;
+  node->routes = route;
+  node->methods |= 1ULL << method;
+  router->routeCount++;
+  return C_OK;
+}
+
+static const inginxRoute *routerNodeRoute(const inginxRouterNode *node, routerSearch *search)
+{
+  const inginxRoute *route;
+  if ((node->methods & (1ULL << search->method)) == 0) {
+    search->allowed |= node->methods;
+    return NULL;
+  }
+  for (route = node->routes; route->method != search->method; route = route->next);
+  return route;
+}
+
+/* Match the path from at on below node, count values were taken so far. */
+static const inginxRoute *routerNodeSearch(const inginxRouterNode *node, size_t at, int32_t count, routerSearch *search)
+{
+  const inginxRouterNode *child;
+  const inginxRoute *route;
+  const char *found;
+  size_t end;
+  if (at == search->length) {
+    if (node->routes != NULL && (route = routerNodeRoute(node, search)) != NULL) {
+      search->count = count;
+      return route;
+    }
+  } else {
+    if (node->childCount > 0 && (found = memchr(node->indices, search->path[at], node->childCount)) != NULL) {
+      child = node->children[found - node->indices];
+      if (search->length - at >= child->prefixLength &&
+          memcmp(child->prefix, search->path + at, child->prefixLength) == 0 &&
+          (route = routerNodeSearch(child, at + child->prefixLength, count, search)) != NULL) {
+        return route;
+      }
+    }
+    if (node->parameter != NULL && search->path[at] != '/') {
+      found = memchr(search->path + at, '/', search->length - at);
+      end = found != NULL ? (size_t) (found - search->path) : search->length;
+      search->values[count].offset = at;
+      search->values[count].length = end - at;
+      if ((route = routerNodeSearch(node->parameter, end, count + 1, search)) != NULL) {
+        return route;
+      }
+    }
+  }
+  if (node->wildcard != NULL && (route = routerNodeRoute(node->wildcard, search)) != NULL) {
+    search->values[count].offset = at;
+    search->values[count].length = search->length - at;
+    search->count = count + 1;
+    return route;
+  }
+  return NULL;
+}
+
+const inginxRoute *inginxRouterMatch(const inginxRouter *router, inginxMethod method, const char *path, size_t length,
+    inginxSlice *values, int32_t *count, uint64_t *allowed)
+{
+  routerSearch search;
+  const inginxRoute *route;
+  search.path = path;
+  search.length = length;
+  search.method = method;
+  search.values = values;
+  search.count = 0;
+  search.allowed = 0;
+  if ((uint32_t) method >= 64) {
+    return NULL;
+  }
+  route = routerNodeSearch(router->root, 0, 0, &search);
+  *count = search.count;
+  if (allowed != NULL) {
+    *allowed |= search.allowed;
+  }
+  return route;
+}
+
+/* The path of the url, without the query string or fragment and past the
+ * authority of an absolute url. */
+static const char *messagePath(const inginxMessage *message, size_t *length)
+{
+  const char *url = message->base + message->url.offset, *end = url + message->url.length, *path = url, *found;
+  if (path < end && *path != '/' && (found = strstr(path, "://")) != NULL && found < end) {
+    if ((path = memchr(found + 3, '/', end - found - 3)) == NULL) {
+      path = end;
+    }
+  }
+  for (found = path; found < end && *found != '?' && *found != '#'; ++found);
+  *length = found - path;
+  return path;
+}
+
+static void routerReject(inginxClient *c, uint64_t allowed)
+{
+  char buffer[256];
+  size_t used = 0;
+  int32_t method;
+  if (allowed == 0) {
+    inginxClientSendError(c, 404);
+  } else {
+    inginxClientSendError(c, 405);
+    for (method = 0; method < 64; ++method) {
+      if ((allowed & (1ULL << method)) && used + 24 < sizeof(buffer)) {
+        used += snprintf(buffer + used, sizeof(buffer) - used, "%s%s", used ? ", " : "", http_method_str(method));
+      }
+    }
+    inginxClientAddHeader(c, "Allow", buffer);
+  }
+  inginxClientAddBodySize(c, NULL, 0);
+}
+
+int32_t inginxRouterDispatch(inginxServer *server, inginxClient *client, inginxMessage *message)
+{
+  const inginxRoute *route;
+  const char *path;
+  size_t length;
+  uint64_t allowed = 0;
+  int32_t idx;
+  if (message->base == NULL) {
+    return C_ERR;
+  }
+  path = messagePath(message, &length);
+  if (length == 0) {
+    /* An absolute url without a path asks for the root. */
+    path = "/";
+    length = 1;
+  }
+  route = inginxRouterMatch(server->router, message->method, path, length, message->routeValues,
+      &message->routeValueCount, &allowed);
+  if (route == NULL) {
+    message->routeValueCount = 0;
+    if (server->listener != NULL && (server->listenerMask & INGINX_EVENT_TYPE_REQUEST)) {
+      return C_ERR;
+    }
+    routerReject(client, allowed);
+    return C_OK;
+  }
+  /* Values are kept relative to the base, like the rest of the head. */
+  for (idx = 0; idx < message->routeValueCount; ++idx) {
+    if (message->routeValues[idx].length > 0) {
+      message->routeValues[idx].offset += path - message->base;
+    } else {
+      message->routeValues[idx].offset = message->url.offset;
+    }
+  }
+  message->route = route;
+  route->handler(server, client, message, route->opaque);
+  return C_OK;
+}
+
+void inginxRouterFree(inginxRouter *router)
+{
+  if (router == NULL) {
+    return;
+  }
+  routerNodeFree(router->root);
+  zfree(router);
+}
+
+int32_t inginxMessageRouteParameterCount(const inginxMessage *message)
+{
+  return message->route != NULL ? message->routeValueCount : 0;
+}
+
+const char *inginxMessageRouteParameterName(const inginxMessage *message, int32_t index)
+{
+  if (message->route == NULL || index < 0 || index >= message->routeValueCount) {
+    return NULL;
+  }
+  return message->route->names[index];
+}
+
+const char *inginxMessageRouteParameterValue(const inginxMessage *message, int32_t index, size_t *length)
+{
+  if (message->route == NULL || message->base == NULL || index < 0 || index >= message->routeValueCount) {
+    return NULL;
+  }
+  if (length != NULL) {
+    *length = message->routeValues[index].length;
+  }
+  return message->base + message->routeValues[index].offset;
+}
+
+const char *inginxMessageRouteParameter(const inginxMessage *message, const char *name, size_t *length)
+{
+  int32_t idx;
+  if (message->route == NULL) {
+    return NULL;
+  }
+  for (idx = 0; idx < message->routeValueCount; ++idx) {
+    if (strcmp(message->route->names[idx], name) == 0) {
+      return inginxMessageRouteParameterValue(message, idx, length);
+    }
+  }
+  return NULL;
+}
@@ -0,0 +1,64 @@
+#ifndef __INGNIX_ROUTER_H__
+#define __INGNIX_ROUTER_H__
+
+#include <stdint.h>
+
+#include "inginx.h"
+#include "networking.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A handler of one method on the node of its pattern. */
+typedef struct inginxRoute {
+  inginxMethod method;
+  inginxRouteHandler handler;
+  void *opaque;
+  int32_t parameterCount;
+  char *names[ROUTE_MAX_PARAMETERS]; /* of :param and * segments, in order */
+  struct inginxRoute *next;          /* other methods of the same node */
+} inginxRoute;
+
+/* Node of a compressed radix tree. Static children are keyed by the first
+ * byte of their prefix, a :param child matches one non empty segment and a *
+ * child the rest of the path. Static children are tried first, then the
+ * :param and then the * one, backtracking when a branch doesn't match. */
+typedef struct inginxRouterNode {
+  char *prefix;
+  uint32_t prefixLength;
+  int32_t childCount;
+  char *indices; /* first byte of the prefix of each child */
+  struct inginxRouterNode **children;
+  struct inginxRouterNode *parameter;
+  struct inginxRouterNode *wildcard;
+  uint64_t methods; /* bit per method of routes */
+  inginxRoute *routes;
+} inginxRouterNode;
+
+/* Built before the server runs, then shared read-only by every worker of
+ * the group. */
+typedef struct inginxRouter {
+  inginxRouterNode *root;
+  int32_t routeCount;
+} inginxRouter;
+
+inginxRouter *inginxRouterCreate(void);
+/* C_ERR if the pattern is malformed or already routed for method. */
+int32_t inginxRouterAdd(inginxRouter *router, inginxMethod method, const char *pattern, inginxRouteHandler handler, void *opaque);
+/* The route of method matching path, NULL if none. Values of the parameters
+ * are stored relative to path, in the order of the pattern. Methods routed
+ * for the path are or'ed into allowed when method isn't one of them. */
+const inginxRoute *inginxRouterMatch(const inginxRouter *router, inginxMethod method, const char *path, size_t length,
+    inginxSlice *values, int32_t *count, uint64_t *allowed);
+/* Run the handler routed for the request, answering 404 or 405 when there is
+ * none unless the listener takes requests. C_ERR if the request is left to
+ * the listener. */
+int32_t inginxRouterDispatch(inginxServer *server, inginxClient *client, inginxMessage *message);
+void inginxRouterFree(inginxRouter *router);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __INGNIX_ROUTER_H__ */
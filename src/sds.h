@@ -125,6 +125,7 @@ struct __attribute__ ((__packed__)) sdshdr64 {
 #define sdsjoinsds(argv, argc, sep, seplen) inginxSdsjoinsds(argv, argc, sep, seplen)
 
 #define sdsMakeRoomFor(s, addlen) inginxSdsMakeRoomFor(s, addlen)
+#define sdsMakeRoomForNonGreedy(s, addlen) inginxSdsMakeRoomForNonGreedy(s, addlen)
 #define sdsIncrLen(s, incr) inginxSdsIncrLen(s, incr)
 #define sdsRemoveFreeSpace(s) inginxSdsRemoveFreeSpace(s)
 #define sdsAllocSize(s) inginxSdsAllocSize(s)
@@ -306,6 +307,7 @@ sds inginxSdsjoinsds(sds *argv, int argc, const char *sep, size_t seplen);
 
 /* Low level functions exposed to the user API */
 sds inginxSdsMakeRoomFor(sds s, size_t addlen);
+sds inginxSdsMakeRoomForNonGreedy(sds s, size_t addlen);
 void inginxSdsIncrLen(sds s, int incr);
 sds inginxSdsRemoveFreeSpace(sds s);
 size_t inginxSdsAllocSize(sds s);
@@ -9,6 +9,9 @@
 
 #include "adlist.h"
 #include "server.h"
+#include "offload.h"
+#include "router.h"
+#include "static.h"
 #include "zmalloc.h"
 
 #define runWithPeriod(_s_, _ms_) if ((_ms_ <= 1000 / _s_->hz) || !(_s_->cronloops%((_ms_)/(1000/_s_->hz))))
@@ -27,13 +30,23 @@ static void doCreateServer(inginxServer *s)
   s->closing = listCreate();
   s->listening = listCreate();
   s->hz = 10;
-  s->maxIdleTime = 1000000000;
-  s->parser = http_parser_execute_strict;
+  s->timeouts[CLIENT_TIMEOUT_IDLE] = CLIENT_DEFAULT_IDLE_TIMEOUT;
+  s->timeouts[CLIENT_TIMEOUT_HEADER] = CLIENT_DEFAULT_HEADER_TIMEOUT;
+  s->timeouts[CLIENT_TIMEOUT_BODY] = CLIENT_DEFAULT_BODY_TIMEOUT;
+  s->timeouts[CLIENT_TIMEOUT_WRITE] = CLIENT_DEFAULT_WRITE_TIMEOUT;
+  s->limits[REQUEST_LIMIT_URL] = CLIENT_DEFAULT_MAX_URL;
+  s->limits[REQUEST_LIMIT_HEADER_BYTES] = CLIENT_DEFAULT_MAX_HEADER_BYTES;
+  s->limits[REQUEST_LIMIT_HEADER_COUNT] = CLIENT_DEFAULT_MAX_HEADER_COUNT;
+  s->limits[REQUEST_LIMIT_BODY] = CLIENT_DEFAULT_MAX_BODY;
+  s->wheel = zcalloc(sizeof(inginxClient *) * TIMEOUT_WHEEL_SLOTS);
+  s->parser = http_parser_execute_request_strict;
 }
 
 inginxServer *inginxServerCreate()
 {
   inginxServer *s = zcalloc(sizeof(inginxServer));
+  /* Threads posting tasks allocate concurrently with the event loop. */
+  zmalloc_enable_thread_safeness();
   signal(SIGHUP, SIG_IGN);
   signal(SIGPIPE, SIG_IGN);
   doCreateServer(s);
@@ -48,6 +61,7 @@ inginxServer *inginxServerGroupCreate(int32_t size, int32_t useProcess)
   }
   inginxServer *s = zcalloc(sizeof(inginxServer) * (size + 1));
   inginxServer *worker;
+  zmalloc_enable_thread_safeness();
   s->group = s + 1;
   s->groupSize = size;
   for (idx = 0; idx < size; ++idx) {
@@ -82,54 +96,6 @@ static void updateCachedTime(inginxServer *s) {
   s->msTime = mstime();
 }
 
-/* Check for timeouts. Returns non-zero if the client was terminated.
- * The function gets the current time in milliseconds as argument since
- * it gets called multiple times in a loop, so calling gettimeofday() for
- * each iteration would be costly without any actual gain. */
-static int32_t clientsCronHandleTimeout(inginxServer *s, inginxClient *c, int64_t now_ms) {
-  time_t now = now_ms / 1000;
-
-  if (s->maxIdleTime && (now - c->lastInteraction > s->maxIdleTime)) {
-    inginxClientFree(s->el, c);
-    return 1;
-  }
-  return 0;
-}
-
-#define CLIENTS_CRON_MIN_ITERATIONS 5
-static void clientsCron(inginxServer *s) {
-  /* Make sure to process at least numclients/server.hz of clients
-   * per call. Since this function is called server.hz times per second
-   * we are sure that in the worst case we process all the clients in 1
-   * second. */
-  int32_t numclients = listLength(s->clients);
-  int32_t iterations = numclients / s->hz;
-  int64_t now = mstime();
-
-  /* Process at least a few clients while we are at it, even if we need
-   * to process less than CLIENTS_CRON_MIN_ITERATIONS to meet our contract
-   * of processing each client once per second. */
-  if (iterations < CLIENTS_CRON_MIN_ITERATIONS)
-      iterations = (numclients < CLIENTS_CRON_MIN_ITERATIONS) ?
-                   numclients : CLIENTS_CRON_MIN_ITERATIONS;
-
-  while (listLength(s->clients) && iterations--) {
-    inginxClient *c;
-    listNode *head;
-
-    /* Rotate the list, take the current head, process.
-     * This way if the client must be removed from the list it's the
-     * first element and we don't incur into O(N) computation. */
-    listRotate(s->clients);
-    head = listFirst(s->clients);
-    c = listNodeValue(head);
-    /* The following functions do different service checks on the client.
-     * The protocol is that they return non-zero if the client was
-     * terminated. */
-    if (clientsCronHandleTimeout(s, c,now)) continue;
-  }
-}
-
 static int32_t serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData)
 {
   AE_NOTUSED(id);
@@ -139,8 +105,8 @@ static int32_t serverCron(struct aeEventLoop *eventLoop, long long id, void *cli
   /* Update the time cache. */
   updateCachedTime(s);
 
-  /* We need to do a few operations on clients asynchronously. */
-  clientsCron(s);
+  /* Close clients whose timeout expired. */
+  inginxClientsHandleTimeouts(eventLoop);
 
   /* Close clients that need to be closed asynchronous */
   inginxClientsFreeInAsyncFreeQueue(eventLoop);
@@ -180,6 +146,94 @@ inginxServer *inginxServerHz(inginxServer *server, int32_t hz)
   }
   return server;
 }
+static inline void doServerTimeout(inginxServer *s, inginxClientTimeout timeout, int32_t ms)
+{
+  int32_t idx;
+  if (s->group) {
+    for (idx = 0; idx < s->groupSize; ++idx) {
+      s->group[idx].timeouts[timeout] = ms > 0 ? ms : 0;
+    }
+  } else {
+    s->timeouts[timeout] = ms > 0 ? ms : 0;
+  }
+}
+
+inginxServer *inginxServerHeaderTimeout(inginxServer *server, int32_t ms)
+{
+  if (server != NULL) {
+    doServerTimeout(server, CLIENT_TIMEOUT_HEADER, ms);
+  }
+  return server;
+}
+
+inginxServer *inginxServerBodyTimeout(inginxServer *server, int32_t ms)
+{
+  if (server != NULL) {
+    doServerTimeout(server, CLIENT_TIMEOUT_BODY, ms);
+  }
+  return server;
+}
+
+inginxServer *inginxServerIdleTimeout(inginxServer *server, int32_t ms)
+{
+  if (server != NULL) {
+    doServerTimeout(server, CLIENT_TIMEOUT_IDLE, ms);
+  }
+  return server;
+}
+
+inginxServer *inginxServerWriteTimeout(inginxServer *server, int32_t ms)
+{
+  if (server != NULL) {
+    doServerTimeout(server, CLIENT_TIMEOUT_WRITE, ms);
+  }
+  return server;
+}
+
+static inline void doServerLimit(inginxServer *s, inginxRequestLimit limit, int64_t value)
+{
+  int32_t idx;
+  if (s->group) {
+    for (idx = 0; idx < s->groupSize; ++idx) {
+      s->group[idx].limits[limit] = value > 0 ? value : 0;
+    }
+  } else {
+    s->limits[limit] = value > 0 ? value : 0;
+  }
+}
+
+inginxServer *inginxServerMaxUrlLength(inginxServer *server, int32_t bytes)
+{
+  if (server != NULL) {
+    doServerLimit(server, REQUEST_LIMIT_URL, bytes);
+  }
+  return server;
+}
+
+inginxServer *inginxServerMaxHeaderBytes(inginxServer *server, int32_t bytes)
+{
+  if (server != NULL) {
+    doServerLimit(server, REQUEST_LIMIT_HEADER_BYTES, bytes);
+  }
+  return server;
+}
+
+inginxServer *inginxServerMaxHeaderCount(inginxServer *server, int32_t count)
+{
+  if (server != NULL) {
+    doServerLimit(server, REQUEST_LIMIT_HEADER_COUNT, count);
+  }
+  return server;
+}
+
+inginxServer *inginxServerMaxBodySize(inginxServer *server, int64_t bytes)
+{
+  if (server != NULL) {
+    doServerLimit(server, REQUEST_LIMIT_BODY, bytes);
+  }
+  return server;
+}
+
 inginxServer *inginxServerBind(inginxServer *s, const char *address, int32_t backlog)
 {
   char *pos;
@@ -243,7 +297,8 @@ inginxServer *inginxServerConnectionLimit(inginxServer *s, int32_t limit)
 }
 
 static inginxClient *createClient(inginxServer *s, int32_t fd) {
-  inginxClient *c = zcalloc(sizeof(inginxClient));
+  inginxClient *c = inginxClientAllocate(s);
+  c->server = s;
 
   /* passing -1 as fd it is possible to create a non connected client.
    * This is useful since all the commands needs to be executed
@@ -253,23 +308,22 @@ static inginxClient *createClient(inginxServer *s, int32_t fd) {
     anetNonBlock(s->error, fd);
     anetEnableTcpNoDelay(s->error, fd);
     anetKeepAlive(s->error, fd, 1);
-    if (aeCreateFileEvent(s->el, fd, AE_READABLE, inginxClientReadFrom, c) == AE_ERR) {
+    if ((s->completion ? aeCreateRecvEvent(s->el, fd, inginxClientRecvFrom, c) :
+        aeCreateFileEvent(s->el, fd, AE_READABLE, inginxClientReadFrom, c)) == AE_ERR) {
       close(fd);
-      zfree(c);
+      inginxClientRecycle(c);
       return NULL;
     }
     listAddNodeTail(s->clients, c);
+    c->clientNode = listLast(s->clients);
   }
-  c->server = s;
 
   http_parser_init(&c->parser, HTTP_REQUEST);
   c->message.major = c->message.minor = c->parser.http_major = c->parser.http_minor = 1;
   c->parser.data = c;
   c->id = 0;
   c->fd = fd;
-  c->message.headers = listCreate();
-  c->reply = listCreate();
-  c->lastInteraction = s->unixTime;
+  inginxClientWaitRequest(c);
 
   serverDispatchEvent(s, c, INGINX_EVENT_TYPE_CONNECTED, c);
   return c;
@@ -293,6 +347,11 @@ static void acceptTcpHandler(aeEventLoop *el, int32_t fd, void *privdata, int32_
   }
 }
 
+static void acceptCompletionHandler(aeEventLoop *el, int32_t fd, void *privdata, int32_t cfd) {
+  inginxServer *s = privdata;
+  createClient(s, cfd);
+}
+
 /* This function gets called every time Redis is entering the
  * main loop of the event driven library, that is, before to sleep
  * for ready file descriptors. */
@@ -305,10 +364,19 @@ static inline void doServerMain(inginxServer *server)
 {
   listIter *it = listGetIterator(server->listening, AL_START_HEAD);
   listNode *ln;
-  int32_t succeeded = 0;
+  int32_t succeeded = 0, fd;
+  server->dispatchingThread = pthread_self();
+  updateCachedTime(server);
+  server->wheelTime = server->msTime - server->msTime % TIMEOUT_WHEEL_RESOLUTION;
+  if (server->completion && aeEnableCompletionEvents(server->el) == AE_ERR) {
+    INGINX_LOG_WARN(server, "Completion based I/O is not available, fallback to readiness. %s",
+        inginxServerErrnoString(server));
+    server->completion = 0;
+  }
   while ((ln = listNext(it)) != NULL) {
-    if (aeCreateFileEvent(server->el, (int32_t) (intptr_t) ln->value, 
-        AE_READABLE, acceptTcpHandler, server) == AE_OK) {
+    fd = (int32_t) (intptr_t) ln->value;
+    if ((server->completion ? aeCreateAcceptEvent(server->el, fd, acceptCompletionHandler, server) :
+        aeCreateFileEvent(server->el, fd, AE_READABLE, acceptTcpHandler, server)) == AE_OK) {
       ++succeeded;
     }
   }
@@ -322,9 +390,20 @@ static inline void doServerMain(inginxServer *server)
   }
   aeSetBeforeSleepProc(server->el, beforeSleep);
   aeMain(server->el);
+  /* Close the connections left. With completion based I/O their clients are
+   * recycled once the kernel released them, at the latest when the event
+   * loop is deleted. */
+  while (listLength(server->clients)) {
+    inginxClientFree(server->el, listNodeValue(listFirst(server->clients)));
+  }
   listRewind(server->listening, it);
   while ((ln = listNext(it)) != NULL) {
-    aeDeleteFileEvent(server->el, (int32_t) (intptr_t) ln->value, AE_READABLE);
+    fd = (int32_t) (intptr_t) ln->value;
+    if (server->completion) {
+      aeDeleteCompletionEvents(server->el, fd, NULL, NULL);
+    } else {
+      aeDeleteFileEvent(server->el, fd, AE_READABLE);
+    }
   }
 
 cleanupExit:
@@ -392,6 +471,10 @@ inline static void doServerFree(inginxServer *server)
     listRelease(server->clients);
   }
   if (server->pending) {
+    /* Its nodes are part of the clients. */
+    while (listLength(server->pending)) {
+      listUnlinkNode(server->pending, listFirst(server->pending));
+    }
     listRelease(server->pending);
   }
   if (server->closing) {
@@ -403,14 +486,23 @@ inline static void doServerFree(inginxServer *server)
   if (server->events) {
     zfree(server->events);
   }
+  if (server->wheel) {
+    zfree(server->wheel);
+  }
+  inginxClientsFreePools(server);
 }
 
 void inginxServerFree(inginxServer *s)
 {
   int32_t idx;
+  inginxStatic *st;
   if (s == NULL) {
     return; 
   }
+  if (s->offload) {
+    inginxOffloadPoolFree(s->offload);
+  }
+  inginxRouterFree(s->router);
   if (s->group) {
     for (idx = 0; idx < s->groupSize; ++idx) {
       doServerFree(s->group + idx);
@@ -418,6 +510,11 @@ void inginxServerFree(inginxServer *s)
   } else {
     doServerFree(s);
   }
+  /* Once the clients still sending cached files are gone. */
+  while ((st = s->statics) != NULL) {
+    s->statics = st->next;
+    inginxStaticFree(st);
+  }
   zfree(s);
 }
 
@@ -506,9 +603,21 @@ void inginxServerSimpleLogger(inginxServer *s, inginxLogLevel level, const char
 
 void inginxServerClientRequest(inginxServer *server, inginxClient *client)
 {
+  if (server->router != NULL && inginxRouterDispatch(server, client, &client->message) == C_OK) {
+    return;
+  }
   serverDispatchEvent(server, client, INGINX_EVENT_TYPE_REQUEST, &client->message);
 }
 
+void inginxServerClientBodyChunk(inginxServer *server, inginxClient *client, const char *data, size_t length)
+{
+  inginxBodyChunk chunk;
+  chunk.message = &client->message;
+  chunk.data = data;
+  chunk.length = length;
+  serverDispatchEvent(server, client, INGINX_EVENT_TYPE_BODY_CHUNK, &chunk);
+}
+
 void inginxServerClientDisconnected(inginxServer *server, inginxClient *client)
 {
   serverDispatchEvent(server, client, INGINX_EVENT_TYPE_DISCONNECTED, client);
@@ -543,7 +652,7 @@ static void doInginxServerParser(inginxServer *server, http_parser_execute parse
 inginxServer *inginxServerStrict(inginxServer *server)
 {
   if (server != NULL) {
-    doInginxServerParser(server, http_parser_execute_strict);
+    doInginxServerParser(server, http_parser_execute_request_strict);
   }
   return server;
 }
@@ -551,11 +660,132 @@ inginxServer *inginxServerStrict(inginxServer *server)
 inginxServer *inginxServerRelaxed(inginxServer *server)
 {
   if (server != NULL) {
-    doInginxServerParser(server, http_parser_execute_relaxed);
+    doInginxServerParser(server, http_parser_execute_request_relaxed);
+  }
+  return server;
+}
+
+static void doInginxServerCompletion(inginxServer *server)
+{
+  int32_t idx;
+  server->completion = 1;
+  if (server->group) {
+    for (idx = 0; idx < server->groupSize; ++idx) {
+      server->group[idx].completion = 1;
+    }
+  }
+}
+
+inginxServer *inginxServerCompletion(inginxServer *server)
+{
+  if (server != NULL) {
+    doInginxServerCompletion(server);
+  }
+  return server;
+}
+
+static void doInginxServerBodyStreaming(inginxServer *server)
+{
+  int32_t idx;
+  server->streaming = 1;
+  if (server->group) {
+    for (idx = 0; idx < server->groupSize; ++idx) {
+      server->group[idx].streaming = 1;
+    }
+  }
+}
+
+inginxServer *inginxServerBodyStreaming(inginxServer *server)
+{
+  if (server != NULL) {
+    doInginxServerBodyStreaming(server);
+  }
+  return server;
+}
+
+int32_t inginxServerClientPoolStats(inginxServer *server, inginxPoolStats *stats)
+{
+  int32_t idx, count = server->group ? server->groupSize : 1;
+  inginxServer *worker;
+  if (stats == NULL) {
+    return C_ERR;
+  }
+  memset(stats, 0, sizeof(inginxPoolStats));
+  for (idx = 0; idx < count; ++idx) {
+    /* Read without synchronization, figures of running workers are approximate. */
+    worker = server->group ? server->group + idx : server;
+    stats->allocated += worker->clientsAllocated;
+    stats->reused += worker->clientsReused;
+    stats->idle += worker->freeClientCount;
+  }
+  return C_OK;
+}
+
+inginxServer *inginxServerOffload(inginxServer *server, int32_t threads, int32_t depth)
+{
+  int32_t idx;
+  if (server == NULL) {
+    return server;
+  }
+  if (server->offload != NULL || threads <= 0 || depth <= 0) {
+    INGINX_LOG_ERROR(server, "Could not create offload pool of %d threads and depth %d", threads, depth);
+    return server;
+  }
+  if ((server->offload = inginxOffloadPoolCreate(threads, depth)) == NULL) {
+    INGINX_LOG_ERROR(server, "Could not start offload threads. %s", inginxServerErrnoString(server));
+    return server;
+  }
+  if (server->group) {
+    for (idx = 0; idx < server->groupSize; ++idx) {
+      server->group[idx].offload = server->offload;
+    }
+  }
+  return server;
+}
+
+inginxServer *inginxServerRoute(inginxServer *server, inginxMethod method, const char *pattern, inginxRouteHandler handler, void *opaque)
+{
+  int32_t idx;
+  if (server == NULL) {
+    return server;
+  }
+  if (server->router == NULL) {
+    server->router = inginxRouterCreate();
+    if (server->group) {
+      for (idx = 0; idx < server->groupSize; ++idx) {
+        server->group[idx].router = server->router;
+      }
+    }
+  }
+  if (inginxRouterAdd(server->router, method, pattern, handler, opaque) != C_OK) {
+    INGINX_LOG_ERROR(server, "Could not route %s %s", http_method_str((enum http_method) method), pattern ? pattern : "(null)");
   }
   return server;
 }
 
+inginxServer *inginxServerStatic(inginxServer *server, const char *prefix, const char *root, int32_t cacheSize)
+{
+  inginxStatic *st;
+  sds trimmed, pattern;
+  if (server == NULL) {
+    return server;
+  }
+  if (prefix == NULL || prefix[0] != '/' || root == NULL) {
+    INGINX_LOG_ERROR(server, "Could not serve files of %s under %s", root ? root : "(null)", prefix ? prefix : "(null)");
+    return server;
+  }
+  st = inginxStaticCreate(server, root, cacheSize);
+  st->next = server->statics;
+  server->statics = st;
+  trimmed = sdstrim(sdsnew(prefix), "/");
+  pattern = sdscatfmt(sdsempty(), "/%S%s*path", trimmed, sdslen(trimmed) ? "/" : "");
+  inginxServerRoute(server, INGINX_METHOD_GET, pattern, inginxStaticServe, st);
+  inginxServerRoute(server, INGINX_METHOD_HEAD, pattern, inginxStaticServe, st);
+  sdsfree(trimmed);
+  sdsfree(pattern);
+  return server;
+}
+
 static void inginxServerFileEvent(aeEventLoop *el, int32_t fd, void *opaque, int32_t mask)
 {
   inginxFileEvent *event = opaque;
@@ -577,6 +807,7 @@ int32_t inginxServerCreateFileEvent(inginxServer *server, int32_t fd, int32_t ma
   int32_t rc = aeCreateFileEvent(server->el, fd, mask, inginxServerFileEvent, event);
   if (rc == AE_OK) {
     event->mask = aeGetFileEvents(server->el, fd);
+    event->opaque = opaque;
     if (mask & INGINX_FILE_EVENT_READABLE) {
       event->read = listener;
     }
@@ -607,12 +838,55 @@ int32_t inginxServerConnect(inginxServer *server, const char *addr, uint16_t por
   return anetTcpNonBlockConnect(server->error, (char *) addr, port);
 }
 
+typedef struct inginxPostedTask
+{
+  inginxTask task;
+  void *opaque;
+} inginxPostedTask;
+
+static void serverRunPostedTask(aeEventLoop *el, void *clientData)
+{
+  inginxPostedTask *posted = clientData;
+  posted->task(el->data, posted->opaque);
+  zfree(posted);
+}
+
+static int32_t doServerPost(inginxServer *server, inginxTask task, void *opaque)
+{
+  inginxPostedTask *posted;
+  if (server->el == NULL) {
+    return C_ERR;
+  }
+  posted = zmalloc(sizeof(inginxPostedTask));
+  posted->task = task;
+  posted->opaque = opaque;
+  aePost(server->el, serverRunPostedTask, posted);
+  return C_OK;
+}
+
+int32_t inginxServerPost(inginxServer *server, inginxTask task, void *opaque)
+{
+  int32_t idx;
+  if (server == NULL || task == NULL) {
+    return C_ERR;
+  }
+  if (server->group) {
+    for (idx = 0; idx < server->groupSize; ++idx) {
+      if (doServerPost(server->group + idx, task, opaque) != C_OK) {
+        return C_ERR;
+      }
+    }
+    return C_OK;
+  }
+  return doServerPost(server, task, opaque);
+}
+
 const char *inginxServerErrnoString(inginxServer *server)
 {
 #ifdef _GNU_SOURCE
   return strerror_r(errno, server->error, sizeof(server->error));
 #else
   strerror_r(errno, server->error, sizeof(server->error));
-  return server->error
+  return server->error;
 #endif
 }
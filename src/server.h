@@ -37,7 +37,10 @@ typedef struct inginxServer
   volatile time_t unixTime;
   int64_t msTime;
   int64_t hz;
-  int64_t maxIdleTime;
+  int64_t timeouts[CLIENT_TIMEOUT_COUNT]; /* in ms by inginxClientTimeout, 0 disables */
+  int64_t limits[REQUEST_LIMIT_COUNT];    /* by inginxRequestLimit, 0 disables */
+  inginxClient **wheel;  /* clients by deadline, TIMEOUT_WHEEL_SLOTS lists */
+  int64_t wheelTime;     /* start of the next slot to expire */
   int32_t cronLoops;
   char error[ANET_ERR_LEN];
   int32_t groupSize;
@@ -45,9 +48,21 @@ typedef struct inginxServer
   pthread_t dispatchingThread;
   http_parser_execute parser;
   inginxFileEvent *events;
+  int32_t completion;
+  int32_t streaming;   /* deliver bodies as BODY_CHUNK events */
+  char *buffers;       /* idle I/O buffers, chained through their first bytes */
+  int32_t freeBuffers;
+  inginxClient *freeClients; /* idle clients, chained through next */
+  int32_t freeClientCount;
+  int64_t clientsAllocated;
+  int64_t clientsReused;
+  struct inginxOffloadPool *offload; /* owned by the group root */
+  struct inginxRouter *router;       /* owned by the group root, read-only once running */
+  struct inginxStatic *statics;      /* owned by the group root, caches are per worker */
 } inginxServer;
 
 void inginxServerClientRequest(inginxServer *inginxServer, inginxClient *client);
+void inginxServerClientBodyChunk(inginxServer *inginxServer, inginxClient *client, const char *data, size_t length);
 void inginxServerClientDisconnected(inginxServer *inginxServer, inginxClient *client);
 void inginxServerClientDestroyed(inginxServer *inginxServer, inginxClient *client);
 
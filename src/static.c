@@ -0,0 +1,473 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "server.h"
+#include "static.h"
+#include "zmalloc.h"
+
+static const struct {
+  const char *extension;
+  const char *type;
+} staticTypes[] = {
+  {"html", "text/html; charset=utf-8"},
+  {"htm", "text/html; charset=utf-8"},
+  {"css", "text/css; charset=utf-8"},
+  {"js", "text/javascript; charset=utf-8"},
+  {"mjs", "text/javascript; charset=utf-8"},
+  {"json", "application/json"},
+  {"map", "application/json"},
+  {"txt", "text/plain; charset=utf-8"},
+  {"xml", "application/xml"},
+  {"svg", "image/svg+xml"},
+  {"png", "image/png"},
+  {"jpg", "image/jpeg"},
+  {"jpeg", "image/jpeg"},
+  {"gif", "image/gif"},
+  {"webp", "image/webp"},
+  {"avif", "image/avif"},
+  {"ico", "image/x-icon"},
+  {"woff", "font/woff"},
+  {"woff2", "font/woff2"},
+  {"ttf", "font/ttf"},
+  {"wasm", "application/wasm"},
+  {"pdf", "application/pdf"},
+  {"mp4", "video/mp4"},
+  {"webm", "video/webm"},
+};
+
+static const char *staticType(const char *path)
+{
+  const char *dot = strrchr(path, '.');
+  size_t idx;
+  if (dot == NULL || strchr(dot, '/') != NULL) {
+    return "application/octet-stream";
+  }
+  for (idx = 0; idx < sizeof(staticTypes) / sizeof(staticTypes[0]); ++idx) {
+    if (strcasecmp(dot + 1, staticTypes[idx].extension) == 0) {
+      return staticTypes[idx].type;
+    }
+  }
+  return "application/octet-stream";
+}
+
+static uint32_t staticHash(const char *path)
+{
+  uint32_t hash = 2166136261u;
+  while (*path) {
+    hash = (hash ^ (unsigned char) *path++) * 16777619u;
+  }
+  return hash;
+}
+
+static inline int hexValue(unsigned char chr)
+{
+  if ((unsigned) (chr - '0') < 10) {
+    return chr - '0';
+  }
+  chr |= 0x20;
+  if ((unsigned) (chr - 'a') < 6) {
+    return chr - 'a' + 10;
+  }
+  return -1;
+}
+
+/* Decode the requested path into a path relative to the root, without
+ * empty, "." or ".." segments, index.html standing for a directory.
+ * Return C_ERR if it can't name a file below the root. */
+static int32_t staticResolve(const char *path, size_t length, char *out, size_t size)
+{
+  const char *end = path + length;
+  size_t used = 0, segment;
+  int hi, lo;
+  char chr;
+  while (path < end) {
+    if ((chr = *path++) == '%') {
+      if (end - path < 2 || (hi = hexValue(path[0])) < 0 || (lo = hexValue(path[1])) < 0 || (hi | lo) == 0) {
+        return C_ERR;
+      }
+      chr = (char) (hi << 4 | lo);
+      path += 2;
+    }
+    if (chr == '/' && (used == 0 || out[used - 1] == '/')) {
+      continue;
+    }
+    if (used + 1 >= size) {
+      return C_ERR;
+    }
+    out[used++] = chr;
+  }
+  out[used] = '\0';
+  for (segment = 0; segment < used; segment += length + 1) {
+    length = strcspn(out + segment, "/");
+    if ((length == 1 && out[segment] == '.') || (length == 2 && out[segment] == '.' && out[segment + 1] == '.')) {
+      return C_ERR;
+    }
+  }
+  if (used == 0 || out[used - 1] == '/') {
+    if (used + sizeof("index.html") > size) {
+      return C_ERR;
+    }
+    memcpy(out + used, "index.html", sizeof("index.html"));
+  }
+  return C_OK;
+}
+
+static void staticEntryRelease(inginxStaticEntry *entry)
+{
+  if (--entry->refs > 0) {
+    return;
+  }
+  close(entry->fd);
+  zfree(entry->path);
+  zfree(entry);
+}
+
+/* Release callback of the file responses. */
+static void staticFileSent(inginxServer *s, int fd, void *opaque)
+{
+  staticEntryRelease(opaque);
+}
+
+static void staticUnlink(inginxStaticWorker *w, inginxStaticEntry *entry)
+{
+  inginxStaticEntry **bucket = w->buckets + (entry->hash & w->mask);
+  while (*bucket != entry) {
+    bucket = &(*bucket)->bucketNext;
+  }
+  *bucket = entry->bucketNext;
+  if (entry->prev) {
+    entry->prev->next = entry->next;
+  } else {
+    w->head = entry->next;
+  }
+  if (entry->next) {
+    entry->next->prev = entry->prev;
+  } else {
+    w->tail = entry->prev;
+  }
+  w->count--;
+  staticEntryRelease(entry);
+}
+
+static inginxStaticEntry *staticLookup(inginxStaticWorker *w, const char *path, uint32_t hash)
+{
+  inginxStaticEntry *entry;
+  for (entry = w->buckets[hash & w->mask]; entry != NULL; entry = entry->bucketNext) {
+    if (entry->hash == hash && strcmp(entry->path, path) == 0) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+static void staticFlush(inginxStaticWorker *w)
+{
+  while (w->head != NULL) {
+    staticUnlink(w, w->head);
+  }
+}
+
+#ifdef __linux__
+static void staticInotifyEvent(inginxServer *s, int32_t fd, int32_t mask, void *opaque)
+{
+  inginxStaticWorker *w = opaque;
+  char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  char path[STATIC_PATH_MAX];
+  const struct inotify_event *event;
+  inginxStaticEntry *entry;
+  ssize_t length;
+  char *at;
+  while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+    for (at = buffer; at < buffer + length; at += sizeof(struct inotify_event) + event->len) {
+      event = (const struct inotify_event *) at;
+      if (event->mask & (IN_Q_OVERFLOW | IN_IGNORED)) {
+        /* Events were lost or a directory is gone. */
+        if (event->wd >= 0 && event->wd < w->directoryCount && (event->mask & IN_IGNORED)) {
+          zfree(w->directories[event->wd]);
+          w->directories[event->wd] = NULL;
+        }
+        staticFlush(w);
+        continue;
+      }
+      if (event->len == 0 || event->wd < 0 || event->wd >= w->directoryCount || w->directories[event->wd] == NULL) {
+        continue;
+      }
+      snprintf(path, sizeof(path), "%s%s%s", w->directories[event->wd], *w->directories[event->wd] ? "/" : "", event->name);
+      if ((entry = staticLookup(w, path, staticHash(path))) != NULL) {
+        staticUnlink(w, entry);
+      }
+    }
+  }
+}
+
+/* Watch the directory of the file, return non-zero on success. */
+static int staticWatch(inginxStatic *st, inginxStaticWorker *w, const char *path)
+{
+  char directory[STATIC_PATH_MAX];
+  const char *slash = strrchr(path, '/');
+  size_t length = slash != NULL ? (size_t) (slash - path) : 0;
+  int wd;
+  if (w->inotify < 0) {
+    return 0;
+  }
+  snprintf(directory, sizeof(directory), "%s/%.*s", st->root, (int) length, path);
+  wd = inotify_add_watch(w->inotify, directory, IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVED_FROM |
+      IN_MOVED_TO | IN_DELETE | IN_CREATE | IN_ONLYDIR);
+  if (wd < 0) {
+    return 0;
+  }
+  if (wd >= w->directoryCount) {
+    w->directories = zrealloc(w->directories, sizeof(char *) * (wd + 1));
+    memset(w->directories + w->directoryCount, 0, sizeof(char *) * (wd + 1 - w->directoryCount));
+    w->directoryCount = wd + 1;
+  }
+  if (w->directories[wd] == NULL) {
+    w->directories[wd] = zmalloc(length + 1);
+    memcpy(w->directories[wd], path, length);
+    w->directories[wd][length] = '\0';
+  }
+  return 1;
+}
+#endif
+
+static void staticWorkerStart(inginxStatic *st, inginxStaticWorker *w, inginxServer *s)
+{
+  w->server = s;
+  w->inotify = -1;
+  for (w->mask = 1; w->mask < (uint32_t) st->capacity; w->mask <<= 1);
+  w->buckets = zcalloc(sizeof(inginxStaticEntry *) * w->mask);
+  w->mask--;
+#ifdef __linux__
+  if ((w->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) >= 0 &&
+      inginxServerCreateFileEvent(s, w->inotify, INGINX_FILE_EVENT_READABLE, staticInotifyEvent, w) != C_OK) {
+    close(w->inotify);
+    w->inotify = -1;
+  }
+  if (w->inotify < 0) {
+    INGINX_LOG_WARN(s, "Could not watch %s, cached files are revalidated instead", st->root);
+  }
+#endif
+}
+
+static void staticDescribe(inginxStaticEntry *entry, const struct stat *st)
+{
+  struct tm tm;
+  time_t mtime = st->st_mtime;
+  entry->size = st->st_size;
+  entry->inode = st->st_ino;
+#ifdef __APPLE__
+  entry->mtime = (int64_t) st->st_mtimespec.tv_sec * 1000000000 + st->st_mtimespec.tv_nsec;
+#else
+  entry->mtime = (int64_t) st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+#endif
+  snprintf(entry->etag, sizeof(entry->etag), "\"%llx-%llx\"", (unsigned long long) entry->size,
+      (unsigned long long) entry->mtime);
+  gmtime_r(&mtime, &tm);
+  strftime(entry->modified, sizeof(entry->modified), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+/* Open the file and cache it, evicting the least recently used one when
+ * full. Return NULL with errno set if it can't be served. */
+static inginxStaticEntry *staticOpen(inginxStatic *st, inginxStaticWorker *w, const char *path, uint32_t hash)
+{
+  char full[STATIC_PATH_MAX];
+  inginxStaticEntry *entry, **bucket;
+  struct stat info;
+  int fd;
+  size_t length;
+  if ((size_t) snprintf(full, sizeof(full), "%s/%s", st->root, path) >= sizeof(full)) {
+    errno = ENAMETOOLONG;
+    return NULL;
+  }
+  if ((fd = open(full, O_RDONLY | O_CLOEXEC)) < 0) {
+    return NULL;
+  }
+  if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+    close(fd);
+    errno = ENOENT;
+    return NULL;
+  }
+  if (w->count >= st->capacity) {
+    staticUnlink(w, w->tail);
+  }
+  entry = zcalloc(sizeof(inginxStaticEntry));
+  length = strlen(path);
+  entry->path = zmalloc(length + 1);
+  memcpy(entry->path, path, length + 1);
+  entry->hash = hash;
+  entry->fd = fd;
+  entry->refs = 1;
+  entry->type = staticType(path);
+  staticDescribe(entry, &info);
+#ifdef __linux__
+  entry->watched = staticWatch(st, w, path);
+#endif
+  entry->validated = w->server->msTime;
+  bucket = w->buckets + (hash & w->mask);
+  entry->bucketNext = *bucket;
+  *bucket = entry;
+  entry->next = w->head;
+  if (w->head) {
+    w->head->prev = entry;
+  } else {
+    w->tail = entry;
+  }
+  w->head = entry;
+  w->count++;
+  return entry;
+}
+
+/* The cached entry of path, opened on a miss. */
+static inginxStaticEntry *staticFind(inginxStatic *st, inginxStaticWorker *w, const char *path)
+{
+  char full[STATIC_PATH_MAX];
+  uint32_t hash = staticHash(path);
+  inginxStaticEntry *entry = staticLookup(w, path, hash);
+  struct stat info;
+  if (entry != NULL && !entry->watched && w->server->msTime - entry->validated >= STATIC_REVALIDATE_MS) {
+    if ((size_t) snprintf(full, sizeof(full), "%s/%s", st->root, path) >= sizeof(full) || stat(full, &info) != 0 || (int64_t) info.st_ino != entry->inode || info.st_size != entry->size ||
+        info.st_mtime != (time_t) (entry->mtime / 1000000000)) {
+      staticUnlink(w, entry);
+      entry = NULL;
+    } else {
+      entry->validated = w->server->msTime;
+    }
+  }
+  if (entry == NULL) {
+    return staticOpen(st, w, path, hash);
+  }
+  if (entry != w->head) {
+    /* Most recently used first. */
+    entry->prev->next = entry->next;
+    if (entry->next) {
+      entry->next->prev = entry->prev;
+    } else {
+      w->tail = entry->prev;
+    }
+    entry->prev = NULL;
+    entry->next = w->head;
+    w->head->prev = entry;
+    w->head = entry;
+  }
+  return entry;
+}
+
+static int staticNotModified(inginxMessage *message, inginxStaticEntry *entry)
+{
+  const char *match = inginxMessageHeaderById(message, INGINX_HEADER_IF_NONE_MATCH);
+  const char *since;
+  if (match != NULL) {
+    return strcmp(match, "*") == 0 || strstr(match, entry->etag) != NULL;
+  }
+  since = inginxMessageHeaderById(message, INGINX_HEADER_IF_MODIFIED_SINCE);
+  return since != NULL && strcmp(since, entry->modified) == 0;
+}
+
+static void staticReject(inginxClient *c, int32_t code)
+{
+  inginxClientSendError(c, code);
+  inginxClientAddBodySize(c, NULL, 0);
+}
+
+void inginxStaticServe(inginxServer *s, inginxClient *c, inginxMessage *message, void *opaque)
+{
+  inginxStatic *st = opaque;
+  inginxStaticWorker *w = st->workers + (st->server->group ? s - st->server->group : 0);
+  inginxStaticEntry *entry;
+  char path[STATIC_PATH_MAX];
+  const char *requested;
+  size_t length;
+  int32_t count = inginxMessageRouteParameterCount(message);
+
+  if (message->method != INGINX_METHOD_GET && message->method != INGINX_METHOD_HEAD) {
+    inginxClientSendError(c, 405);
+    inginxClientAddHeader(c, "Allow", "GET, HEAD");
+    inginxClientAddBodySize(c, NULL, 0);
+    return;
+  }
+  if (count > 0) {
+    requested = inginxMessageRouteParameterValue(message, count - 1, &length);
+  } else {
+    requested = inginxMessageUrl(message);
+    length = strcspn(requested, "?#");
+  }
+  if (staticResolve(requested, length, path, sizeof(path)) != C_OK) {
+    staticReject(c, 404);
+    return;
+  }
+  if (w->server == NULL) {
+    staticWorkerStart(st, w, s);
+  }
+  if ((entry = staticFind(st, w, path)) == NULL) {
+    INGINX_LOG_DEBUG(s, "Could not serve %s/%s: %s", st->root, path, inginxServerErrnoString(s));
+    staticReject(c, errno == EACCES ? 403 : errno == ENOENT || errno == ENOTDIR || errno == ENAMETOOLONG ? 404 : 500);
+    return;
+  }
+  if (staticNotModified(message, entry)) {
+    inginxClientSetStatus(c, 304);
+    inginxClientAddHeader(c, "ETag", entry->etag);
+    inginxClientAddReply(c, "\r\n");
+    return;
+  }
+  inginxClientSetStatus(c, 200);
+  inginxClientAddHeader(c, "Content-Type", entry->type);
+  inginxClientAddHeader(c, "ETag", entry->etag);
+  inginxClientAddHeader(c, "Last-Modified", entry->modified);
+  if (message->method == INGINX_METHOD_HEAD) {
+    inginxClientAddHeaderPrintf(c, "Content-Length", "%lld", (long long) entry->size);
+    inginxClientAddReply(c, "\r\n");
+    return;
+  }
+  entry->refs++;
+  inginxClientSendFileRelease(c, entry->fd, 0, entry->size, staticFileSent, entry);
+}
+
+inginxStatic *inginxStaticCreate(inginxServer *server, const char *root, int32_t capacity)
+{
+  inginxStatic *st = zcalloc(sizeof(inginxStatic));
+  size_t length = strlen(root);
+  while (length > 1 && root[length - 1] == '/') {
+    length--;
+  }
+  st->server = server;
+  st->root = zmalloc(length + 1);
+  memcpy(st->root, root, length);
+  st->root[length] = '\0';
+  st->capacity = capacity > 0 ? capacity : STATIC_CACHE_DEFAULT;
+  st->workerCount = server->group ? server->groupSize : 1;
+  st->workers = zcalloc(sizeof(inginxStaticWorker) * st->workerCount);
+  return st;
+}
+
+void inginxStaticFree(inginxStatic *st)
+{
+  inginxStaticWorker *w;
+  int32_t idx, wd;
+  for (idx = 0; idx < st->workerCount; ++idx) {
+    w = st->workers + idx;
+    if (w->server == NULL) {
+      continue;
+    }
+    staticFlush(w);
+    if (w->inotify >= 0) {
+      close(w->inotify);
+    }
+    for (wd = 0; wd < w->directoryCount; ++wd) {
+      zfree(w->directories[wd]);
+    }
+    zfree(w->directories);
+    zfree(w->buckets);
+  }
+  zfree(st->workers);
+  zfree(st->root);
+  zfree(st);
+}
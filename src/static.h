@@ -0,0 +1,70 @@
+#ifndef __INGNIX_STATIC_H__
+#define __INGNIX_STATIC_H__
+
+#include <stdint.h>
+
+#include "inginx.h"
+#include "networking.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define STATIC_CACHE_DEFAULT  1024 /* Files kept open per worker */
+#define STATIC_PATH_MAX       4096
+#define STATIC_REVALIDATE_MS  1000 /* Stat cached files without inotify this often */
+
+/* A file of the cache of a worker, shared by the responses sending it. */
+typedef struct inginxStaticEntry {
+  char *path; /* relative to the root, decoded */
+  uint32_t hash;
+  int fd;
+  int32_t refs; /* one while cached, plus one per response sending it */
+  int32_t watched; /* invalidated through inotify, revalidated otherwise */
+  int64_t validated; /* ms, last stat when not watched */
+  int64_t size;
+  int64_t inode;
+  int64_t mtime; /* ns */
+  const char *type;
+  char etag[48];
+  char modified[32];
+  struct inginxStaticEntry *bucketNext;
+  struct inginxStaticEntry *prev; /* LRU order, most recent first */
+  struct inginxStaticEntry *next;
+} inginxStaticEntry;
+
+/* Cache of a worker, only touched from its event loop. */
+typedef struct inginxStaticWorker {
+  inginxServer *server; /* NULL until the first request */
+  int inotify; /* -1 if unavailable */
+  char **directories; /* watched directories relative to the root, by watch descriptor */
+  int32_t directoryCount;
+  inginxStaticEntry **buckets;
+  uint32_t mask;
+  int32_t count;
+  inginxStaticEntry *head;
+  inginxStaticEntry *tail;
+} inginxStaticWorker;
+
+/* Files below root, answered through a route of the server. */
+typedef struct inginxStatic {
+  inginxServer *server; /* the group root */
+  char *root;
+  int32_t capacity;
+  int32_t workerCount;
+  inginxStaticWorker *workers;
+  struct inginxStatic *next; /* other file trees of the server */
+} inginxStatic;
+
+inginxStatic *inginxStaticCreate(inginxServer *server, const char *root, int32_t capacity);
+/* Route handler, opaque being the inginxStatic. The file is the last route
+ * parameter, or the path of the url without one. */
+void inginxStaticServe(inginxServer *s, inginxClient *c, inginxMessage *message, void *opaque);
+/* Once the workers are stopped. */
+void inginxStaticFree(inginxStatic *st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __INGNIX_STATIC_H__ */